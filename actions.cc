@@ -61,8 +61,24 @@ void ActionSchema::set_effect(const Effect& effect) {
 void ActionSchema::instantiations(ActionSet& actions, const TermTable& terms,
                                   const AtomSet& atoms,
                                   const ValueMap& values) const {
+  instantiations(actions, terms, atoms, values, 0, 1);
+}
+
+
+/* Fills the provided list with the instantiations of this action
+   schema that belong to the given part out of the given number of
+   parts.  Part i gets every object with a position congruent to i
+   modulo the number of parts in the list of objects for the first
+   parameter. */
+void ActionSchema::instantiations(ActionSet& actions, const TermTable& terms,
+                                  const AtomSet& atoms,
+                                  const ValueMap& values,
+                                  size_t part, size_t parts) const {
   size_t n = parameters().size();
   if (n == 0) {
+    if (part != 0) {
+      return;
+    }
     const StateFormula& precond =
       precondition().instantiation(SubstitutionMap(), terms,
                                    atoms, values, false);
@@ -74,9 +90,18 @@ void ActionSchema::instantiations(ActionSet& actions, const TermTable& terms,
     SubstitutionMap args;
     std::vector<const ObjectList*> arguments(n);
     std::vector<ObjectList::const_iterator> next_arg;
+    ObjectList first_args;
+    const ObjectList& objects =
+      terms.compatible_objects(TermTable::type(parameters()[0]));
+    for (size_t i = part; i < objects.size(); i += parts) {
+      first_args.push_back(objects[i]);
+    }
+    arguments[0] = &first_args;
     for (size_t i = 0; i < n; i++) {
-      Type t = TermTable::type(parameters()[i]);
-      arguments[i] = &terms.compatible_objects(t);
+      if (i > 0) {
+        Type t = TermTable::type(parameters()[i]);
+        arguments[i] = &terms.compatible_objects(t);
+      }
       if (arguments[i]->empty()) {
         return;
       }
@@ -163,7 +188,8 @@ std::ostream& operator<<(std::ostream& os, const ActionSchema& a) {
 
 /* Constructs an action with the given name. */
 Action::Action(const std::string& name)
-  : name_(name), precondition_(&StateFormula::TRUE), effect_(&Effect::EMPTY) {
+  : name_(name), precondition_(&StateFormula::TRUE), effect_(&Effect::EMPTY),
+    index_(0) {
   RCObject::ref(precondition_);
   RCObject::ref(effect_);
 }
@@ -182,6 +208,7 @@ void Action::set_precondition(const StateFormula& precondition) {
     RCObject::ref(&precondition);
     RCObject::destructive_deref(precondition_);
     precondition_ = &precondition;
+    precondition_program_ = FormulaProgram();
   }
 }
 
@@ -192,6 +219,7 @@ void Action::set_effect(const Effect& effect) {
     RCObject::ref(&effect);
     RCObject::destructive_deref(effect_);
     effect_ = &effect;
+    effect_program_ = EffectProgram();
   }
 }
 
@@ -199,17 +227,27 @@ void Action::set_effect(const Effect& effect) {
 /* Tests if this action is enabled in the given state. */
 bool Action::enabled(const TermTable& terms,
                      const AtomSet& atoms, const ValueMap& values) const {
-  return precondition().holds(terms, atoms, values);
+  if (precondition_program_.compiled()) {
+    return precondition_program_.holds(terms, atoms, values);
+  } else {
+    return precondition().holds(terms, atoms, values);
+  }
 }
 
 
-/* Changes the given state according to the effects of this action. */
+/* Changes the given state according to the effects of this action,
+   sampled with the given random stream. */
 void Action::affect(const TermTable& terms,
-                    AtomSet& atoms, ValueMap& values) const {
+                    AtomSet& atoms, ValueMap& values, Random& random) const {
+  if (effect_program_.compiled()) {
+    effect_program_.affect(terms, atoms, values, random);
+    return;
+  }
   AtomList adds;
   AtomList deletes;
   UpdateList updates;
-  effect().state_change(adds, deletes, updates, terms, atoms, values);
+  effect().state_change(adds, deletes, updates, terms, atoms, values,
+                        random);
   for (AtomList::const_iterator ai = deletes.begin();
        ai != deletes.end(); ai++) {
     atoms.erase(*ai);
@@ -222,6 +260,52 @@ void Action::affect(const TermTable& terms,
 }
 
 
+/* Changes the given state according to the effects of this action,
+   sampled with the given random stream, and fills the provided lists
+   with the atoms that were added or deleted and the fluents whose
+   values changed. */
+void Action::affect(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+                    AtomList& changed_atoms, FluentList& changed_fluents,
+                    Random& random) const {
+  if (effect_program_.compiled()) {
+    effect_program_.affect(terms, atoms, values, changed_atoms,
+                           changed_fluents, random);
+    return;
+  }
+  AtomList adds;
+  AtomList deletes;
+  UpdateList updates;
+  effect().state_change(adds, deletes, updates, terms, atoms, values,
+                        random);
+  for (AtomList::const_iterator ai = deletes.begin();
+       ai != deletes.end(); ai++) {
+    if (atoms.erase(*ai) > 0) {
+      changed_atoms.push_back(*ai);
+    }
+  }
+  for (AtomList::const_iterator ai = adds.begin(); ai != adds.end(); ai++) {
+    if (atoms.insert(*ai).second) {
+      changed_atoms.push_back(*ai);
+    }
+  }
+  for (UpdateList::const_iterator ui = updates.begin();
+       ui != updates.end(); ui++) {
+    const Fluent* fluent = &(*ui)->fluent();
+    ValueMap::const_iterator vi = values.find(fluent);
+    if (vi == values.end()) {
+      (*ui)->affect(values);
+      changed_fluents.push_back(fluent);
+    } else {
+      Number old_value = (*vi).second;
+      (*ui)->affect(values);
+      if (values[fluent] != old_value) {
+        changed_fluents.push_back(fluent);
+      }
+    }
+  }
+}
+
+
 /* Output operator for actions. */
 std::ostream& operator<<(std::ostream& os, const Action& a) {
   os << '(' << a.name();
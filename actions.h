@@ -24,6 +24,7 @@
 #include "effects.h"
 #include "formulas.h"
 #include "expressions.h"
+#include "programs.h"
 #include "terms.h"
 #include <iostream>
 #include <map>
@@ -76,6 +77,14 @@ struct ActionSchema {
   void instantiations(ActionSet& actions, const TermTable& terms,
                       const AtomSet& atoms, const ValueMap& values) const;
 
+  /* Fills the provided list with the instantiations of this action
+     schema that belong to the given part out of the given number of
+     parts.  The parts split the objects for the first parameter, so
+     they can be instantiated independently of each other. */
+  void instantiations(ActionSet& actions, const TermTable& terms,
+                      const AtomSet& atoms, const ValueMap& values,
+                      size_t part, size_t parts) const;
+
   /* Returns an instantiation of this action schema. */
   const Action& instantiation(const SubstitutionMap& subst,
                               const TermTable& terms,
@@ -130,6 +139,17 @@ struct Action {
   /* Sets the effect of this action. */
   void set_effect(const Effect& effect);
 
+  /* Sets the index of this action. */
+  void set_index(size_t index) { index_ = index; }
+
+  /* Compiles the precondition and the effect of this action, so that
+     testing if the action is enabled and applying the action run the
+     compiled programs. */
+  void compile() {
+    precondition_program_ = FormulaProgram(precondition());
+    effect_program_ = EffectProgram(effect());
+  }
+
   /* Returns the name of this action. */
   const std::string& name() const { return name_; }
 
@@ -142,12 +162,26 @@ struct Action {
   /* Returns the effect of this action. */
   const Effect& effect() const { return *effect_; }
 
+  /* Returns the index of this action among the actions of its
+     problem. */
+  size_t index() const { return index_; }
+
   /* Tests if this action is enabled in the given state. */
   bool enabled(const TermTable& terms,
                const AtomSet& atoms, const ValueMap& values) const;
 
-  /* Changes the given state according to the effects of this action. */
-  void affect(const TermTable& terms, AtomSet& atoms, ValueMap& values) const;
+  /* Changes the given state according to the effects of this action,
+     sampled with the given random stream. */
+  void affect(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+              Random& random) const;
+
+  /* Changes the given state according to the effects of this action,
+     sampled with the given random stream, and fills the provided lists
+     with the atoms that were added or deleted and the fluents whose
+     values changed. */
+  void affect(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+              AtomList& changed_atoms, FluentList& changed_fluents,
+              Random& random) const;
 
  private:
   /* Action name. */
@@ -156,8 +190,14 @@ struct Action {
   ObjectList arguments_;
   /* Action precondition. */
   const StateFormula* precondition_;
+  /* Compiled action precondition, if compiled. */
+  FormulaProgram precondition_program_;
   /* Action effect. */
   const Effect* effect_;
+  /* Compiled action effect, if compiled. */
+  EffectProgram effect_program_;
+  /* Index of this action among the actions of its problem. */
+  size_t index_;
 };
 
 /* Output operator for actions. */
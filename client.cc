@@ -19,7 +19,10 @@
 #include "client.h"
 #include "strxml.h"
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <map>
 #include <sstream>
 #include <unistd.h>
 
@@ -55,58 +58,95 @@ static bool sessionRequestInfo(const XMLNode* node, int& rounds,
 }
 
 
-/* Extracts an action from the given XML node. */
-static const Atom* getAtom(const Problem& problem, const XMLNode* atomNode) {
-  if (atomNode == 0 || atomNode->getName() != "atom") {
-    return 0;
+/* Returns the object with the given name, or 0 if no such object
+   exists or the object is not of the given type. */
+static const Object* getObject(const Problem& problem,
+                               const std::string& name, Type type) {
+  const Object* o = problem.terms().find_object(name);
+  if (o == 0) {
+    o = problem.domain().terms().find_object(name);
   }
-
-  std::string predicate_name;
-  if (!atomNode->dissect("predicate", predicate_name)) {
+  if (o == 0 || !TypeTable::subtype(TermTable::type(*o), type)) {
     return 0;
   }
+  return o;
+}
+
+
+/* Returns the atom with the given predicate and terms, or 0 if no such
+   atom exists. */
+static const Atom* makeAtom(const Problem& problem,
+                            const std::string& predicate_name,
+                            const str_vec& term_names) {
   const Predicate* p =
     problem.domain().predicates().find_predicate(predicate_name);
-  if (p == 0) {
+  if (p == 0 || PredicateTable::parameters(*p).size() != term_names.size()) {
     return 0;
   }
 
   TermList terms;
-  size_t argIndex = 0;
-  for (int i = 0; i < atomNode->size(); i++) {
-    const XMLNode* termNode = atomNode->getChild(i);
-    if (termNode == 0 || termNode->getName() != "term") {
-      continue;
-    }
-    if (argIndex >= PredicateTable::parameters(*p).size()) {
+  for (size_t i = 0; i < term_names.size(); i++) {
+    const Object* o = getObject(problem, term_names[i],
+                                PredicateTable::parameters(*p)[i]);
+    if (o == 0) {
       return 0;
     }
-    Type correctType = PredicateTable::parameters(*p)[argIndex];
-    argIndex++;
-
-    std::string term_name = termNode->getText();
-    const Object* o = problem.terms().find_object(term_name);
-    if (o != 0) {
-      if (!TypeTable::subtype(TermTable::type(*o), correctType)) {
-        return 0;
-      }
-    } else {
-      o = problem.domain().terms().find_object(term_name);
-      if (o == 0) {
-        return 0;
-      } else if (!TypeTable::subtype(TermTable::type(*o), correctType)) {
-        return 0;
-      }
-    }
+    terms.push_back(*o);
+  }
+
+  return &Atom::make(*p, terms);
+}
+
 
+/* Returns the fluent with the given function and terms, or 0 if no
+   such fluent exists. */
+static const Fluent* makeFluent(const Problem& problem,
+                                const std::string& function_name,
+                                const str_vec& term_names) {
+  const Function* f =
+    problem.domain().functions().find_function(function_name);
+  if (f == 0 || FunctionTable::parameters(*f).size() != term_names.size()) {
+    return 0;
+  }
+
+  TermList terms;
+  for (size_t i = 0; i < term_names.size(); i++) {
+    const Object* o = getObject(problem, term_names[i],
+                                FunctionTable::parameters(*f)[i]);
+    if (o == 0) {
+      return 0;
+    }
     terms.push_back(*o);
   }
 
-  if (PredicateTable::parameters(*p).size() != terms.size()) {
+  return &Fluent::make(*f, terms);
+}
+
+
+/* Returns the text of the term children of the given XML node. */
+static str_vec getTerms(const XMLNode* node) {
+  str_vec term_names;
+  for (int i = 0; i < node->size(); i++) {
+    const XMLNode* termNode = node->getChild(i);
+    if (termNode != 0 && termNode->getName() == "term") {
+      term_names.push_back(std::string(termNode->getText()));
+    }
+  }
+  return term_names;
+}
+
+
+/* Extracts an atom from the given XML node. */
+static const Atom* getAtom(const Problem& problem, const XMLNode* atomNode) {
+  if (atomNode == 0 || atomNode->getName() != "atom") {
     return 0;
   }
 
-  return &Atom::make(*p, terms);
+  std::string predicate_name;
+  if (!atomNode->dissect("predicate", predicate_name)) {
+    return 0;
+  }
+  return makeAtom(problem, predicate_name, getTerms(atomNode));
 }
 
 
@@ -121,78 +161,100 @@ static const Fluent* getFluent(const Problem& problem,
   if (!appNode->dissect("function", function_name)) {
     return 0;
   }
-  const Function* f =
-    problem.domain().functions().find_function(function_name);
-  if (f == 0) {
-    return 0;
+  return makeFluent(problem, function_name, getTerms(appNode));
+}
+
+
+/* Removes all atoms and fluents from the given state. */
+static void clearState(AtomSet& atoms, ValueMap& values) {
+  for (AtomSet::const_iterator ai = atoms.begin(); ai != atoms.end(); ai++) {
+    RCObject::destructive_deref(*ai);
+  }
+  atoms.clear();
+  for (ValueMap::const_iterator vi = values.begin();
+       vi != values.end(); vi++) {
+    RCObject::destructive_deref((*vi).first);
   }
+  values.clear();
+}
 
-  TermList terms;
-  size_t argIndex = 0;
-  for (int i = 0; i<appNode->size(); i++) {
-    const XMLNode* termNode = appNode->getChild(i);
-    if (!termNode || termNode->getName() != "term") {
-      continue;
-    }
-    if (argIndex >= FunctionTable::parameters(*f).size()) {
-      return 0;
-    }
-    Type correctType = FunctionTable::parameters(*f)[argIndex];
-    argIndex++;
-
-    std::string term_name = termNode->getText();
-    const Object* o = problem.terms().find_object(term_name);
-    if (o != 0) {
-      if (!TypeTable::subtype(TermTable::type(*o), correctType)) {
-        return 0;
-      }
-    } else {
-      o = problem.domain().terms().find_object(term_name);
-      if (o == 0) {
-        return 0;
-      }
-      else if (!TypeTable::subtype(TermTable::type(*o), correctType)) {
-        return 0;
-      }
-    }
 
-    terms.push_back(*o);
+/* Adds the given atom to the given state. */
+static void addAtom(AtomSet& atoms, const Atom* atom) {
+  if (atom != 0 && atoms.insert(atom).second) {
+    RCObject::ref(atom);
   }
+}
 
-  if (FunctionTable::parameters(*f).size() != terms.size()) {
-    return 0;
+
+/* Deletes the given atom from the given state. */
+static void deleteAtom(AtomSet& atoms, const Atom* atom) {
+  if (atom != 0) {
+    if (atoms.erase(atom) == 0) {
+      RCObject::ref(atom);
+    }
+    RCObject::destructive_deref(atom);
   }
+}
+
 
-  return &Fluent::make(*f,terms);
+/* Sets the value of the given fluent in the given state. */
+static void setValue(ValueMap& values,
+                     const Fluent* fluent, const Number& value) {
+  if (fluent != 0) {
+    if (values.find(fluent) == values.end()) {
+      RCObject::ref(fluent);
+    }
+    values[fluent] = value;
+  }
 }
 
 
-/* Extracts a state from the given XML node. */
+/* Returns the fluent value written in the given string.  A server
+   with rational values writes fractions, which a client with double
+   values reads as well. */
+static Number getNumber(const std::string& s) {
+#ifdef DOUBLE_VALUES
+  if (s.find('/') == std::string::npos) {
+    return strtod(s.c_str(), 0);
+  }
+#endif
+  return to_number(Rational(s.c_str()));
+}
+
+
+/* Extracts a state from the given XML node.  A "state" node replaces
+   the given state, while a "state-delta" node lists the atoms added
+   to and deleted from the given state and the fluents that changed
+   value. */
 static bool getState(AtomSet& atoms, ValueMap& values,
                      const Problem& problem, const XMLNode* stateNode) {
   if (stateNode == 0) {
     return false;
   }
-  if (stateNode->getName() != "state") {
+  if (stateNode->getName() == "state") {
+    clearState(atoms, values);
+  } else if (stateNode->getName() != "state-delta") {
     return false;
   }
 
   for (int i = 0; i < stateNode->size(); i++) {
     const XMLNode* cn = stateNode->getChild(i);
     if (cn->getName() == "atom") {
-      const Atom* atom = getAtom(problem, cn);
-      if (atom != 0) {
-        atoms.insert(atom);
-        RCObject::ref(atom);
+      addAtom(atoms, getAtom(problem, cn));
+    } else if (cn->getName() == "add") {
+      for (int j = 0; j < cn->size(); j++) {
+        addAtom(atoms, getAtom(problem, cn->getChild(j)));
       }
-    }
-    else if (cn->getName() == "fluent") {
-      const Fluent* fluent = getFluent(problem, cn);
+    } else if (cn->getName() == "delete") {
+      for (int j = 0; j < cn->size(); j++) {
+        deleteAtom(atoms, getAtom(problem, cn->getChild(j)));
+      }
+    } else if (cn->getName() == "fluent") {
       std::string value_str;
       if (!cn->dissect("value", value_str))
         return false;
-      values.insert(std::make_pair(fluent, Rational(value_str.c_str())));
-      RCObject::ref(fluent);
+      setValue(values, getFluent(problem, cn), getNumber(value_str));
     }
   }
 
@@ -200,6 +262,216 @@ static bool getState(AtomSet& atoms, ValueMap& values,
 }
 
 
+/* ====================================================================== */
+/* Dictionary */
+
+/*
+ * The atoms, fluents, and actions of a problem, as identified by the
+ * server in binary mode.
+ */
+struct Dictionary {
+  /* Atoms, indexed by id. */
+  std::vector<const Atom*> atoms;
+  /* Fluents, indexed by id. */
+  std::vector<const Fluent*> fluents;
+  /* Ids of actions, indexed by action index. */
+  std::vector<uint32_t> action_ids;
+
+  /* Deletes this dictionary. */
+  ~Dictionary() {
+    for (size_t i = 0; i < atoms.size(); i++) {
+      if (atoms[i] != 0) {
+        RCObject::destructive_deref(atoms[i]);
+      }
+    }
+    for (size_t i = 0; i < fluents.size(); i++) {
+      if (fluents[i] != 0) {
+        RCObject::destructive_deref(fluents[i]);
+      }
+    }
+  }
+
+  /* Returns the atom with the given id, or 0 if no such atom exists. */
+  const Atom* atom(uint32_t id) const {
+    return (id < atoms.size()) ? atoms[id] : 0;
+  }
+
+  /* Returns the fluent with the given id, or 0 if no such fluent
+     exists. */
+  const Fluent* fluent(uint32_t id) const {
+    return (id < fluents.size()) ? fluents[id] : 0;
+  }
+};
+
+
+/* Decodes a name followed by a list of names. */
+static bool getNames(FrameDecoder& decoder, std::string& name,
+                     str_vec& names) {
+  std::string_view s;
+  uint32_t n;
+  if (!decoder.string(s) || !decoder.u32(n)) {
+    return false;
+  }
+  name = s;
+  names.clear();
+  for (uint32_t i = 0; i < n; i++) {
+    if (!decoder.string(s)) {
+      return false;
+    }
+    names.push_back(std::string(s));
+  }
+  return true;
+}
+
+
+/* Extracts a dictionary from the given frame contents. */
+static bool getDictionary(Dictionary& dictionary, const Problem& problem,
+                          std::string_view data) {
+  FrameDecoder decoder(data);
+  std::string name;
+  str_vec names;
+  uint32_t n, id;
+  if (!decoder.u32(n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if (!decoder.u32(id) || !getNames(decoder, name, names)) {
+      return false;
+    }
+    const Atom* atom = makeAtom(problem, name, names);
+    if (atom != 0) {
+      if (id >= dictionary.atoms.size()) {
+        dictionary.atoms.resize(id + 1);
+      }
+      if (dictionary.atoms[id] == 0) {
+        dictionary.atoms[id] = atom;
+        RCObject::ref(atom);
+      }
+    }
+  }
+  if (!decoder.u32(n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if (!decoder.u32(id) || !getNames(decoder, name, names)) {
+      return false;
+    }
+    const Fluent* fluent = makeFluent(problem, name, names);
+    if (fluent != 0) {
+      if (id >= dictionary.fluents.size()) {
+        dictionary.fluents.resize(id + 1);
+      }
+      if (dictionary.fluents[id] == 0) {
+        dictionary.fluents[id] = fluent;
+        RCObject::ref(fluent);
+      }
+    }
+  }
+
+  std::map<str_vec, const Action*> actions;
+  for (ActionSet::const_iterator ai = problem.actions().begin();
+       ai != problem.actions().end(); ai++) {
+    names.clear();
+    names.push_back((*ai)->name());
+    for (ObjectList::const_iterator oi = (*ai)->arguments().begin();
+         oi != (*ai)->arguments().end(); oi++) {
+      std::ostringstream os;
+      os << *oi;
+      names.push_back(os.str());
+    }
+    actions[names] = *ai;
+  }
+  dictionary.action_ids.assign(problem.actions().size(), UINT32_MAX);
+  if (!decoder.u32(n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if (!decoder.u32(id) || !getNames(decoder, name, names)) {
+      return false;
+    }
+    names.insert(names.begin(), name);
+    std::map<str_vec, const Action*>::const_iterator ai = actions.find(names);
+    if (ai != actions.end()) {
+      dictionary.action_ids[(*ai).second->index()] = id;
+    }
+  }
+  return decoder.empty();
+}
+
+
+/* Extracts a state from the given state or state delta frame. */
+static bool getState(AtomSet& atoms, ValueMap& values,
+                     const Dictionary& dictionary,
+                     int type, std::string_view data) {
+  FrameDecoder decoder(data);
+  uint8_t goal;
+  uint32_t n, id;
+  if (!decoder.u8(goal)) {
+    return false;
+  }
+  if (type == STATE_FRAME) {
+    clearState(atoms, values);
+    if (!decoder.u32(n)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      if (!decoder.u32(id)) {
+        return false;
+      }
+      addAtom(atoms, dictionary.atom(id));
+    }
+  } else if (type == STATE_DELTA_FRAME) {
+    if (!decoder.u32(n)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      if (!decoder.u32(id)) {
+        return false;
+      }
+      addAtom(atoms, dictionary.atom(id));
+    }
+    if (!decoder.u32(n)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      if (!decoder.u32(id)) {
+        return false;
+      }
+      deleteAtom(atoms, dictionary.atom(id));
+    }
+  } else {
+    return false;
+  }
+  if (!decoder.u32(n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    int64_t numerator, denominator;
+    if (!decoder.u32(id) || !decoder.i64(numerator)
+        || !decoder.i64(denominator)) {
+      return false;
+    }
+#ifdef DOUBLE_VALUES
+    if (denominator == 0) {
+      double value;
+      std::memcpy(&value, &numerator, sizeof value);
+      setValue(values, dictionary.fluent(id), value);
+      continue;
+    }
+#endif
+    if (denominator == 0) {
+      return false;
+    }
+    setValue(values, dictionary.fluent(id),
+             to_number(Rational(numerator, denominator)));
+  }
+  return decoder.empty();
+}
+
+
+/* ====================================================================== */
+/* XMLClient */
+
 /* Sends an action on the given stream. */
 static void sendAction(std::ostream& os, const Action* action) {
   if (action == 0) {
@@ -215,116 +487,158 @@ static void sendAction(std::ostream& os, const Action* action) {
 }
 
 
-/* ====================================================================== */
-/* XMLClient */
+/* Sends the given message to the server, in an XML frame in binary
+   mode. */
+static void sendMessage(int fd, bool binary, const std::string& message) {
+  std::string out;
+  if (binary) {
+    size_t frame = begin_frame(out, XML_FRAME);
+    out += message;
+    end_frame(out, frame);
+  } else {
+    out = message;
+  }
+  if (! write(fd, out.data(), out.size()))
+    EXIT_ERROR;
+}
+
+
+/* Reads a message from the server, in an XML frame in binary mode.
+   Returns 0 on error. */
+static const XMLNode* readMessage(XMLReader& reader, bool binary) {
+  if (!binary) {
+    return read_node(reader);
+  }
+  int type;
+  std::string_view data;
+  if (!read_frame(reader, type, data) || type != XML_FRAME) {
+    return 0;
+  }
+  return reader.parse(data);
+}
+
 
 /* Constructs an XML client */
 XMLClient::XMLClient(Planner& planner, const Problem& problem,
-                     const std::string& name, int fd) {
+                     const std::string& name, int fd, bool binary) {
   std::ostringstream os;
   os.str("");
   os << "<session-request>"
      <<  "<name>" << name << "</name>"
      <<  "<problem>" << problem.name() << "</problem>"
-     << "</session-request>";
+     <<  "<delta/>";
+  if (binary) {
+    os << "<binary/>";
+  }
+  os << "</session-request>";
   if (! write(fd, os.str().c_str(), os.str().length())) 
       EXIT_ERROR;
 
-  const XMLNode* sessionInitNode = read_node(fd);
+  XMLReader reader(fd);
+  const XMLNode* sessionInitNode = read_node(reader);
 
   int total_rounds, round_turns;
   std::chrono::milliseconds round_time;
   if (!sessionRequestInfo(sessionInitNode,
                           total_rounds, round_time, round_turns)) {
     std::cerr << "Error in server's session-request response" << std::endl;
-    if (sessionInitNode != 0) {
-      delete sessionInitNode;
-    }
     return;
   }
 
-  if (sessionInitNode != 0) {
-    delete sessionInitNode;
+  /* The server sends frames after the session-init, starting with a
+     dictionary, only if it accepts binary mode. */
+  binary = binary
+    && sessionInitNode->getChild("setting")->getChild("binary") != 0;
+  Dictionary dictionary;
+  if (binary) {
+    int type;
+    std::string_view data;
+    if (!read_frame(reader, type, data) || type != DICTIONARY_FRAME
+        || !getDictionary(dictionary, problem, data)) {
+      std::cerr << "Error in server's dictionary" << std::endl;
+      return;
+    }
   }
 
+  /* The current state, which the server may send as changes to the
+     previous state after the first turn of a round. */
+  AtomSet atoms;
+  ValueMap values;
   int rounds_left = total_rounds;
   while (rounds_left) {
     rounds_left--;
-    os.str("");
-    os << "<round-request/>";
-    if (! write(fd, os.str().c_str(), os.str().length()))
-      EXIT_ERROR;
-    const XMLNode* roundInitNode = read_node(fd);
+    sendMessage(fd, binary, "<round-request/>");
+    const XMLNode* roundInitNode = readMessage(reader, binary);
     if (!roundInitNode || roundInitNode->getName() != "round-init") {
       std::cerr << "Error in server's round-request response" << std::endl;
-      if (roundInitNode != 0) {
-        delete roundInitNode;
-      }
       return;
     }
 
-    delete roundInitNode;
-
     planner.initRound();
 
     const XMLNode* response = 0;
     while (1) {
-
-      if (response != 0) {
-        delete response;
+      int type = XML_FRAME;
+      std::string_view data;
+      if (!binary) {
+        response = read_node(reader);
+      } else if (!read_frame(reader, type, data)) {
+        response = 0;
+      } else if (type == XML_FRAME) {
+        response = reader.parse(data);
       }
 
-      response = read_node(fd);
-
-      if (!response) {
+      if (type != XML_FRAME) {
+        if (!getState(atoms, values, dictionary, type, data)) {
+          std::cerr << "Invalid state frame" << std::endl;
+          clearState(atoms, values);
+          return;
+        }
+      } else if (!response) {
         std::cerr << "Invalid state response" << std::endl;
+        clearState(atoms, values);
         return;
-      }
-
-      if (response->getName() == "end-round"
-          || response->getName() == "end-session") {
+      } else if (response->getName() == "end-round"
+                 || response->getName() == "end-session") {
         std::cout << response << std::endl;
         break;
-      }
-
-      AtomSet atoms;
-      ValueMap values;
-      if (!getState(atoms, values, problem, response)) {
+      } else if (!getState(atoms, values, problem, response)) {
         std::cerr << "Invalid state response: " << response << std::endl;
-        delete response;
+        clearState(atoms, values);
         return;
       }
 
       const Action *a = planner.decideAction(atoms, values);
-      for (AtomSet::const_iterator ai = atoms.begin();
-           ai != atoms.end(); ai++) {
-        RCObject::destructive_deref(*ai);
-      }
-      for (ValueMap::const_iterator vi = values.begin();
-           vi != values.end(); vi++) {
-        RCObject::destructive_deref((*vi).first);
-      }
 
-      os.str("");
-      sendAction(os, a);
-      if (! write(fd, os.str().c_str(), os.str().length()))
-	  EXIT_ERROR;
+      if (binary) {
+        std::string out;
+        if (a != 0 && dictionary.action_ids[a->index()] != UINT32_MAX) {
+          size_t frame = begin_frame(out, ACTION_FRAME);
+          append_u32(out, dictionary.action_ids[a->index()]);
+          end_frame(out, frame);
+        } else {
+          end_frame(out, begin_frame(out, DONE_FRAME));
+        }
+        if (! write(fd, out.data(), out.size()))
+          EXIT_ERROR;
+      } else {
+        os.str("");
+        sendAction(os, a);
+        if (! write(fd, os.str().c_str(), os.str().length()))
+          EXIT_ERROR;
+      }
     }
 
+    clearState(atoms, values);
     planner.endRound();
 
     if (response && response->getName() == "end-session") {
-      delete response;
       break;
     }
-    if (response != 0) {
-      delete response;
-    }
   }
-  const XMLNode* endSessionNode = read_node(fd);
+  const XMLNode* endSessionNode = readMessage(reader, binary);
 
   if (endSessionNode) {
     std::cout << endSessionNode << std::endl;
-    delete endSessionNode;
   }
 }
@@ -62,9 +62,10 @@ protected:
  * An XML client.
  */
 struct XMLClient {
-  /* Constructs an XML client. */
+  /* Constructs an XML client.  In binary mode, the client asks the
+     server to send messages in binary frames instead of XML. */
   XMLClient(Planner& planner, const Problem& problem, const std::string& name,
-            int fd);
+            int fd, bool binary);
 };
 
 
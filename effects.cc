@@ -51,7 +51,7 @@ std::ostream& operator<<(std::ostream& os, const Update& u) {
 
 /* Changes the given state according to this update. */
 void Assign::affect(ValueMap& values) const {
-  values[&fluent()] = expression().value(values);
+  values[&fluent()] = value(values);
 }
 
 
@@ -78,7 +78,7 @@ void ScaleUp::affect(ValueMap& values) const {
   if (vi == values.end()) {
     throw std::logic_error("changing undefined value");
   } else {
-    values[&fluent()] = (*vi).second * expression().value(values);
+    values[&fluent()] = (*vi).second * value(values);
   }
 }
 
@@ -105,7 +105,7 @@ void ScaleDown::affect(ValueMap& values) const {
   if (vi == values.end()) {
     throw std::logic_error("changing undefined value");
   } else {
-    values[&fluent()] = (*vi).second / expression().value(values);
+    values[&fluent()] = (*vi).second / value(values);
   }
 }
 
@@ -133,7 +133,7 @@ void Increase::affect(ValueMap& values) const {
   if (vi == values.end()) {
     throw std::logic_error("changing undefined value");
   } else {
-    values[&fluent()] = (*vi).second + expression().value(values);
+    values[&fluent()] = (*vi).second + value(values);
   }
 }
 
@@ -161,7 +161,7 @@ void Decrease::affect(ValueMap& values) const {
   if (vi == values.end()) {
     throw std::logic_error("changing undefined value");
   } else {
-    values[&fluent()] = (*vi).second - expression().value(values);
+    values[&fluent()] = (*vi).second - value(values);
   }
 }
 
@@ -193,7 +193,8 @@ struct EmptyEffect : public Effect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const {}
+                            const ValueMap& values,
+                            Random& random) const {}
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -295,7 +296,8 @@ void AddEffect::state_change(AtomList& adds, AtomList& deletes,
                              UpdateList& updates,
                              const TermTable& terms,
                              const AtomSet& atoms,
-                             const ValueMap& values) const {
+                             const ValueMap& values,
+                             Random& random) const {
   adds.push_back(&atom());
 }
 
@@ -329,7 +331,8 @@ void DeleteEffect::state_change(AtomList& adds, AtomList& deletes,
                                 UpdateList& updates,
                                 const TermTable& terms,
                                 const AtomSet& atoms,
-                                const ValueMap& values) const {
+                                const ValueMap& values,
+                                Random& random) const {
   deletes.push_back(&atom());
 }
 
@@ -388,7 +391,8 @@ void UpdateEffect::state_change(AtomList& adds, AtomList& deletes,
                                 UpdateList& updates,
                                 const TermTable& terms,
                                 const AtomSet& atoms,
-                                const ValueMap& values) const {
+                                const ValueMap& values,
+                                Random& random) const {
   updates.push_back(update_);
 }
 
@@ -445,10 +449,12 @@ void ConjunctiveEffect::state_change(AtomList& adds, AtomList& deletes,
                                      UpdateList& updates,
                                      const TermTable& terms,
                                      const AtomSet& atoms,
-                                     const ValueMap& values) const {
+                                     const ValueMap& values,
+                                     Random& random) const {
   for (EffectList::const_iterator ei = conjuncts().begin();
        ei != conjuncts().end(); ei++) {
-    (*ei)->state_change(adds, deletes, updates, terms, atoms, values);
+    (*ei)->state_change(adds, deletes, updates, terms, atoms, values,
+                        random);
   }
 }
 
@@ -517,10 +523,12 @@ void ConditionalEffect::state_change(AtomList& adds, AtomList& deletes,
                                      UpdateList& updates,
                                      const TermTable& terms,
                                      const AtomSet& atoms,
-                                     const ValueMap& values) const {
-  if (condition().holds(terms, atoms, values)) {
+                                     const ValueMap& values,
+                                     Random& random) const {
+  if (condition_holds(terms, atoms, values)) {
     /* Effect condition holds. */
-    effect().state_change(adds, deletes, updates, terms, atoms, values);
+    effect().state_change(adds, deletes, updates, terms, atoms, values,
+                          random);
   }
 }
 
@@ -554,6 +562,7 @@ ProbabilisticEffect::make(const std::vector<std::pair<Rational,
       for (; i < os.size(); i++) {
         peff.add_outcome(os[i].first, *os[i].second);
       }
+      peff.build_alias_table();
       return peff;
     }
   }
@@ -593,9 +602,9 @@ bool ProbabilisticEffect::add_outcome(const Rational& p,
       weight_sum_ = p.denominator();
       return true;
     } else {
-      std::pair<int, int> m =
+      std::pair<int64_t, int64_t> m =
         Rational::multipliers(weight_sum_, p.denominator());
-      int sum = 0;
+      int64_t sum = 0;
       size_t n = size();
       for (size_t i = 0; i < n; i++) {
         sum += weights_[i] *= m.first;
@@ -610,24 +619,78 @@ bool ProbabilisticEffect::add_outcome(const Rational& p,
 }
 
 
+/* Builds the alias table once all outcomes have been added, using
+   Vose's method in integer arithmetic so that the table represents
+   the weights exactly. */
+void ProbabilisticEffect::build_alias_table() {
+  size_t n = size();
+  std::vector<long long> scaled;
+  long long wtot = 0;
+  for (size_t i = 0; i < n; i++) {
+    wtot += weights_[i];
+  }
+  if (wtot < weight_sum_) {
+    n++;
+  }
+  for (size_t i = 0; i < size(); i++) {
+    scaled.push_back((long long) weights_[i]*n);
+  }
+  if (n > size()) {
+    scaled.push_back((weight_sum_ - wtot)*n);
+  }
+  thresholds_.assign(n, weight_sum_);
+  aliases_.resize(n);
+  std::vector<size_t> small, large;
+  for (size_t i = 0; i < n; i++) {
+    aliases_[i] = i;
+    if (scaled[i] < weight_sum_) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    size_t s = small.back();
+    small.pop_back();
+    size_t l = large.back();
+    thresholds_[s] = scaled[s];
+    aliases_[s] = l;
+    scaled[l] -= weight_sum_ - scaled[s];
+    if (scaled[l] < weight_sum_) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+}
+
+
+/* Returns the index of an outcome sampled with the given random
+   stream, or size() if no outcome was sampled. */
+size_t ProbabilisticEffect::sample(Random& random) const {
+  if (size() == 0) {
+    return 0;
+  }
+  uint64_t w = random.below(thresholds_.size()*uint64_t(weight_sum_));
+  size_t i = w/weight_sum_;
+  if (w%weight_sum_ >= uint64_t(thresholds_[i])) {
+    i = aliases_[i];
+  }
+  return (i < size()) ? i : size();
+}
+
+
 /* Fills the provided lists with a sampled state change for this
    effect in the given state. */
 void ProbabilisticEffect::state_change(AtomList& adds, AtomList& deletes,
                                        UpdateList& updates,
                                        const TermTable& terms,
                                        const AtomSet& atoms,
-                                       const ValueMap& values) const {
-  if (size() != 0) {
-    int w = int(rand()/(RAND_MAX + 1.0)*weight_sum_);
-    int wtot = 0;
-    size_t n = size();
-    for (size_t i = 0; i < n; i++) {
-      wtot += weights_[i];
-      if (w < wtot) {
-        effect(i).state_change(adds, deletes, updates, terms, atoms, values);
-        return;
-      }
-    }
+                                       const ValueMap& values,
+                                       Random& random) const {
+  size_t i = sample(random);
+  if (i < size()) {
+    effect(i).state_change(adds, deletes, updates, terms, atoms, values,
+                           random);
   }
 }
 
@@ -645,6 +708,7 @@ ProbabilisticEffect::instantiation(const SubstitutionMap& subst,
                             effect(i).instantiation(subst, terms,
                                                     atoms, values));
   }
+  inst_effect.build_alias_table();
   return inst_effect;
 }
 
@@ -700,7 +764,8 @@ void QuantifiedEffect::state_change(AtomList& adds, AtomList& deletes,
                                     UpdateList& updates,
                                     const TermTable& terms,
                                     const AtomSet& atoms,
-                                    const ValueMap& values) const {
+                                    const ValueMap& values,
+                                    Random& random) const {
   throw std::logic_error("Quantified::state_change not implemented");
 }
 
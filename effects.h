@@ -23,9 +23,11 @@
 #include <config.h>
 #include "formulas.h"
 #include "expressions.h"
+#include "programs.h"
 #include "refcount.h"
 #include "terms.h"
 #include "rational.h"
+#include "random.h"
 #include <iostream>
 #include <utility>
 #include <vector>
@@ -54,10 +56,28 @@ struct Update {
   virtual const Update& instantiation(const SubstitutionMap& subst,
                                       const ValueMap& values) const = 0;
 
+  /* Compiles the expression of this update, which must be ground, so
+     that changing a state runs the compiled program. */
+  void compile() {
+    if (!program_.compiled()) {
+      program_ = ExpressionProgram(expression());
+    }
+  }
+
  protected:
   /* Constructs an update. */
   Update(const Fluent& fluent, const Expression& expr);
 
+  /* Returns the value of the expression of this update in the given
+     state. */
+  Number value(const ValueMap& values) const {
+    if (program_.compiled()) {
+      return program_.value(values);
+    } else {
+      return expression().value(values);
+    }
+  }
+
   /* Prints this object on the given stream. */
   virtual void print(std::ostream& os) const = 0;
 
@@ -66,6 +86,8 @@ struct Update {
   const Fluent* fluent_;
   /* Expression. */
   const Expression* expr_;
+  /* Compiled expression, if compiled. */
+  ExpressionProgram program_;
 
   friend std::ostream& operator<<(std::ostream& os, const Update& u);
 };
@@ -218,12 +240,14 @@ struct Effect : public RCObject {
   bool empty() const { return this == &EMPTY; }
 
   /* Fills the provided lists with a sampled state change for this
-     effect in the given state. */
+     effect in the given state, drawing random numbers from the given
+     stream. */
   virtual void state_change(AtomList& adds, AtomList& deletes,
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const = 0;
+                            const ValueMap& values,
+                            Random& random) const = 0;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -294,7 +318,8 @@ struct AddEffect : public SimpleEffect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -324,7 +349,8 @@ struct DeleteEffect : public SimpleEffect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -360,7 +386,8 @@ struct UpdateEffect : public Effect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -400,7 +427,8 @@ struct ConjunctiveEffect : public Effect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -446,13 +474,32 @@ struct ConditionalEffect : public Effect {
   /* Returns the conditional effect of this effect. */
   const Effect& effect() const { return *effect_; }
 
+  /* Compiles the condition of this effect, which must be ground, so
+     that testing the condition runs the compiled program. */
+  void compile() {
+    if (!condition_program_.compiled()) {
+      condition_program_ = FormulaProgram(condition());
+    }
+  }
+
+  /* Tests if the condition of this effect holds in the given state. */
+  bool condition_holds(const TermTable& terms,
+                       const AtomSet& atoms, const ValueMap& values) const {
+    if (condition_program_.compiled()) {
+      return condition_program_.holds(terms, atoms, values);
+    } else {
+      return condition().holds(terms, atoms, values);
+    }
+  }
+
   /* Fills the provided lists with a sampled state change for this
      effect in the given state. */
   virtual void state_change(AtomList& adds, AtomList& deletes,
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -467,6 +514,8 @@ struct ConditionalEffect : public Effect {
  private:
   /* Effect condition. */
   const StateFormula* condition_;
+  /* Compiled effect condition, if compiled. */
+  FormulaProgram condition_program_;
   /* Effect. */
   const Effect* effect_;
 
@@ -500,13 +549,18 @@ struct ProbabilisticEffect : public Effect {
   /* Returns the ith outcome's effect. */
   const Effect& effect(size_t i) const { return *effects_[i]; }
 
+  /* Returns the index of an outcome sampled with the given random
+     stream, or size() if no outcome was sampled. */
+  size_t sample(Random& random) const;
+
   /* Fills the provided lists with a sampled state change for this
      effect in the given state. */
   virtual void state_change(AtomList& adds, AtomList& deletes,
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
@@ -520,17 +574,28 @@ struct ProbabilisticEffect : public Effect {
 
  private:
   /* Weights associated with outcomes. */
-  std::vector<int> weights_;
+  std::vector<int64_t> weights_;
   /* The sum of weights. */
-  int weight_sum_;
+  int64_t weight_sum_;
   /* Outcome effects. */
   EffectList effects_;
+  /* Alias table for sampling outcomes: each entry is split into the
+     entry itself, with weight thresholds_[i], and aliases_[i], with
+     the remaining weight up to weight_sum_.  An entry equal to size()
+     stands for the lack of an outcome, if the weights add up to less
+     than weight_sum_. */
+  std::vector<int64_t> thresholds_;
+  /* Aliases of the entries in the alias table. */
+  std::vector<size_t> aliases_;
 
   /* Constructs an empty probabilistic effect. */
   ProbabilisticEffect() : weight_sum_(0) {}
 
   /* Adds an outcome to this probabilistic effect. */
   bool add_outcome(const Rational& p, const Effect& effect);
+
+  /* Builds the alias table once all outcomes have been added. */
+  void build_alias_table();
 };
 
 
@@ -560,7 +625,8 @@ struct QuantifiedEffect : public Effect {
                             UpdateList& updates,
                             const TermTable& terms,
                             const AtomSet& atoms,
-                            const ValueMap& values) const;
+                            const ValueMap& values,
+                            Random& random) const;
 
   /* Returns an instantiation of this effect. */
   virtual const Effect& instantiation(const SubstitutionMap& subst,
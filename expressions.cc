@@ -32,7 +32,7 @@ std::ostream& operator<<(std::ostream& os, const Expression& e) {
 /* Value */
 
 /* Returns the value of this expression in the given state. */
-Rational Value::value(const ValueMap& values) const {
+Number Value::value(const ValueMap& values) const {
   return value_;
 }
 
@@ -54,57 +54,109 @@ void Value::print(std::ostream& os) const {
 /* Fluent */
 
 /* Table of fluents. */
-Fluent::FluentTable Fluent::fluents;
-
-
-/* Comparison function. */
-bool Fluent::FluentLess::operator()(const Fluent* f1, const Fluent* f2) const {
-  if (f1->function() < f2->function()) {
-    return true;
-  } else if (f2->function() < f1->function()) {
-    return false;
-  } else {
-    return f1->terms() < f2->terms();
+InternTable<Fluent> Fluent::fluents;
+/* Indexed fluents, with 0 in place of deleted fluents. */
+std::vector<const Fluent*> Fluent::indexed_fluents;
+/* Guards the table of fluents. */
+std::mutex Fluent::table_mutex;
+/* Whether fluents added to the table are pinned. */
+bool Fluent::pinning = false;
+/* Fluents pinned since pin_all() was called. */
+std::vector<const Fluent*> Fluent::pinned_fluents;
+
+
+/* Returns the hash value of a fluent with the given function and
+   terms. */
+size_t Fluent::hash(const Function& function, const TermList& terms) {
+  uint64_t h = std::hash<Function>()(function);
+  for (TermList::const_iterator ti = terms.begin(); ti != terms.end(); ti++) {
+    h = (h ^ std::hash<Term>()(*ti))*0x9e3779b97f4a7c15ULL;
   }
+  /* The table picks slots with the low bits, so mix in the high bits. */
+  h = (h ^ (h >> 31))*0xbf58476d1ce4e5b9ULL;
+  return h ^ (h >> 29);
 }
 
 
 /* Returns a fluent with the given function and terms. */
 const Fluent& Fluent::make(const Function& function, const TermList& terms) {
-  Fluent* fluent = new Fluent(function);
   bool ground = true;
   for (TermList::const_iterator ti = terms.begin(); ti != terms.end(); ti++) {
-    fluent->add_term(*ti);
-    if (ground && (*ti).variable()) {
+    if ((*ti).variable()) {
       ground = false;
+      break;
     }
   }
   if (!ground) {
+    Fluent* fluent = new Fluent(function);
+    fluent->terms_ = terms;
     return *fluent;
-  } else {
-    std::pair<FluentTable::const_iterator, bool> result =
-      fluents.insert(fluent);
-    if (!result.second) {
-      delete fluent;
-      return **result.first;
-    } else {
-      return *fluent;
-    }
   }
+  size_t h = hash(function, terms);
+  std::lock_guard<std::mutex> lock(table_mutex);
+  const Fluent* old_fluent = fluents.find(h, [&](const Fluent* f) {
+      return f->function() == function && f->terms() == terms;
+    });
+  if (old_fluent != 0) {
+    return *old_fluent;
+  }
+  Fluent* fluent = new Fluent(function);
+  fluent->terms_ = terms;
+  fluents.insert(fluent, h);
+  if (pinning) {
+    ref(fluent);
+    pinned_fluents.push_back(fluent);
+  }
+  return *fluent;
 }
 
 
 /* Deletes this fluent. */
 Fluent::~Fluent() {
-  FluentTable::const_iterator fi = fluents.find(this);
-  if (*fi == this) {
-    fluents.erase(fi);
+  std::lock_guard<std::mutex> lock(table_mutex);
+  fluents.erase(this, hash(function(), terms()));
+  if (indexed()) {
+    indexed_fluents[index_] = 0;
+  }
+}
+
+
+/* Keeps every ground fluent added to the table from now on alive until
+   unpin_all() is called. */
+void Fluent::pin_all() {
+  std::lock_guard<std::mutex> lock(table_mutex);
+  pinning = true;
+}
+
+
+/* Releases the fluents pinned since pin_all() was called. */
+void Fluent::unpin_all() {
+  std::vector<const Fluent*> pinned;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex);
+    pinning = false;
+    pinned.swap(pinned_fluents);
+  }
+  for (std::vector<const Fluent*>::const_iterator fi = pinned.begin();
+       fi != pinned.end(); fi++) {
+    destructive_deref(*fi);
   }
 }
 
 
+/* Returns the index of this fluent, assigning the next free index to
+   this fluent if it has none. */
+size_t Fluent::index() const {
+  if (!indexed()) {
+    index_ = indexed_fluents.size();
+    indexed_fluents.push_back(this);
+  }
+  return index_;
+}
+
+
 /* Returns the value of this expression in the given state. */
-Rational Fluent::value(const ValueMap& values) const {
+Number Fluent::value(const ValueMap& values) const {
   ValueMap::const_iterator vi = values.find(this);
   if (vi != values.end()) {
     return (*vi).second;
@@ -245,7 +297,7 @@ const Expression& Addition::make(const Expression& term1,
 
 
 /* Returns the value of this expression in the given state. */
-Rational Addition::value(const ValueMap& values) const {
+Number Addition::value(const ValueMap& values) const {
   return operand1().value(values) + operand2().value(values);
 }
 
@@ -292,7 +344,7 @@ const Expression& Subtraction::make(const Expression& term1,
 
 
 /* Returns the value of this expression in the given state. */
-Rational Subtraction::value(const ValueMap& values) const {
+Number Subtraction::value(const ValueMap& values) const {
   return operand1().value(values) - operand2().value(values);
 }
 
@@ -339,7 +391,7 @@ const Expression& Multiplication::make(const Expression& factor1,
 
 
 /* Returns the value of this expression in the given state. */
-Rational Multiplication::value(const ValueMap& values) const {
+Number Multiplication::value(const ValueMap& values) const {
   return operand1().value(values) * operand2().value(values);
 }
 
@@ -389,7 +441,7 @@ const Expression& Division::make(const Expression& factor1,
 
 
 /* Returns the value of this expression in the given state. */
-Rational Division::value(const ValueMap& values) const {
+Number Division::value(const ValueMap& values) const {
   return operand1().value(values) / operand2().value(values);
 }
 
@@ -411,3 +463,36 @@ const Expression& Division::instantiation(const SubstitutionMap& subst,
 void Division::print(std::ostream& os) const {
   os << "(/ " << operand1() << ' ' << operand2() << ")";
 }
+
+
+/* ====================================================================== */
+/* ValueMap */
+
+/* Adds the given entry to this map, unless the fluent already has a
+   value. */
+std::pair<ValueMap::const_iterator, bool>
+ValueMap::insert(const value_type& value) {
+  const_iterator vi = find(value.first);
+  if (vi != end()) {
+    return std::make_pair(vi, false);
+  } else {
+    entry(value.first).second = value.second;
+    return std::make_pair(find(value.first), true);
+  }
+}
+
+
+/* Returns the entry for the given fluent, adding it if needed. */
+ValueMap::value_type& ValueMap::entry(const Fluent* fluent) {
+  size_t index = fluent->index();
+  if (index >= entries_.size()) {
+    entries_.resize(index + 1, value_type(0, 0));
+  }
+  value_type& entry = entries_[index];
+  if (entry.first == 0) {
+    entry.first = fluent;
+    entry.second = 0;
+    size_++;
+  }
+  return entry;
+}
@@ -22,12 +22,52 @@
 
 #include <config.h>
 #include "refcount.h"
+#include "interntable.h"
 #include "functions.h"
 #include "terms.h"
 #include "rational.h"
+#include <cstddef>
 #include <iostream>
-#include <map>
+#include <mutex>
 #include <set>
+#include <utility>
+#include <vector>
+
+
+/* ====================================================================== */
+/* Number */
+
+/*
+ * Type of fluent values.  Fluent values are exact rational numbers,
+ * unless the package is configured with --enable-double-values, in
+ * which case they are IEEE double-precision numbers: arithmetic on
+ * doubles never overflows and is faster, but it rounds, and division
+ * by zero yields an infinity rather than an error.  Probabilities are
+ * exact rational numbers either way.
+ */
+#ifdef DOUBLE_VALUES
+typedef double Number;
+#else
+typedef Rational Number;
+#endif
+
+/* Returns the fluent value for the given rational number. */
+inline Number to_number(const Rational& q) {
+#ifdef DOUBLE_VALUES
+  return q.double_value();
+#else
+  return q;
+#endif
+}
+
+/* Returns the double value of the given fluent value. */
+inline double to_double(const Number& x) {
+#ifdef DOUBLE_VALUES
+  return x;
+#else
+  return x.double_value();
+#endif
+}
 
 
 /* ====================================================================== */
@@ -40,7 +80,7 @@ struct ValueMap;
  */
 struct Expression : public RCObject {
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const = 0;
+  virtual Number value(const ValueMap& values) const = 0;
 
   /* Returns an instantiation of this expression. */
   virtual const Expression& instantiation(const SubstitutionMap& subst,
@@ -65,13 +105,18 @@ std::ostream& operator<<(std::ostream& os, const Expression& e);
  */
 struct Value : public Expression {
   /* Constructs a constant value. */
-  explicit Value(const Rational& value) : value_(value) {}
+  explicit Value(const Number& value) : value_(value) {}
+
+#ifdef DOUBLE_VALUES
+  /* Constructs a constant value from a rational number. */
+  explicit Value(const Rational& value) : value_(to_number(value)) {}
+#endif
 
   /* Returns the value of this expression. */
-  const Rational& value() const { return value_; }
+  const Number& value() const { return value_; }
 
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns an instantiation of this expression. */
   virtual const Value& instantiation(const SubstitutionMap& subst,
@@ -83,7 +128,7 @@ struct Value : public Expression {
 
  private:
   /* The value. */
-  Rational value_;
+  Number value_;
 };
 
 
@@ -97,6 +142,24 @@ struct Fluent : public Expression {
   /* Returns a fluent with the given function and terms. */
   static const Fluent& make(const Function& function, const TermList& terms);
 
+  /* Returns the fluent with the given index, or 0 if no such fluent
+     exists. */
+  static const Fluent* indexed_fluent(size_t index) {
+    return (index < indexed_fluents.size()) ? indexed_fluents[index] : 0;
+  }
+
+  /* Returns the number of indices assigned to fluents. */
+  static size_t num_indexed() { return indexed_fluents.size(); }
+
+  /* Keeps every ground fluent added to the table from now on alive
+     until unpin_all() is called.  While fluents are pinned, make() can
+     be called from several threads at once, provided that the fluents
+     that already exist are kept alive by their owners. */
+  static void pin_all();
+
+  /* Releases the fluents pinned since pin_all() was called. */
+  static void unpin_all();
+
   /* Deletes this fluent. */
   virtual ~Fluent();
 
@@ -106,8 +169,16 @@ struct Fluent : public Expression {
   /* Returns the terms of this fluent. */
   const TermList& terms() const { return terms_; }
 
+  /* Tests if this fluent has been assigned an index. */
+  bool indexed() const { return index_ != NO_INDEX; }
+
+  /* Returns the index of this fluent, assigning the next free index
+     to this fluent if it has none.  Only ground fluents can be
+     indexed. */
+  size_t index() const;
+
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns this fluent subject to the given substitution. */
   const Fluent& substitution(const SubstitutionMap& subst) const;
@@ -121,30 +192,34 @@ struct Fluent : public Expression {
   virtual void print(std::ostream& os) const;
 
  private:
-  /* Less-than comparison function object for fluents. */
-  struct FluentLess
-    : public std::binary_function<const Fluent*, const Fluent*, bool> {
-    /* Comparison function. */
-    bool operator()(const Fluent* f1, const Fluent* f2) const;
-  };
+  /* Returns the hash value of a fluent with the given function and
+     terms. */
+  static size_t hash(const Function& function, const TermList& terms);
 
-  /* A table of fluents. */
-  struct FluentTable : std::set<const Fluent*, FluentLess> {
-  };
+  /* Index of fluents that have not been assigned an index. */
+  static const size_t NO_INDEX = size_t(-1);
 
   /* Table of fluents. */
-  static FluentTable fluents;
+  static InternTable<Fluent> fluents;
+  /* Indexed fluents, with 0 in place of deleted fluents. */
+  static std::vector<const Fluent*> indexed_fluents;
+  /* Guards the table of fluents. */
+  static std::mutex table_mutex;
+  /* Whether fluents added to the table are pinned. */
+  static bool pinning;
+  /* Fluents pinned since pin_all() was called. */
+  static std::vector<const Fluent*> pinned_fluents;
 
   /* Function of this fluent. */
   Function function_;
   /* Terms of this fluent. */
   TermList terms_;
+  /* Index of this fluent in value maps. */
+  mutable size_t index_;
 
   /* Constructs a fluent with the given function. */
-  explicit Fluent(const Function& function) : function_(function) {}
-
-  /* Adds a term to this fluent. */
-  void add_term(Term term) { terms_.push_back(term); }
+  explicit Fluent(const Function& function)
+    : function_(function), index_(NO_INDEX) {}
 };
 
 
@@ -188,7 +263,7 @@ struct Addition : public Computation {
                                 const Expression& term2);
 
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns an instantiation of this expression. */
   virtual const Expression& instantiation(const SubstitutionMap& subst,
@@ -217,7 +292,7 @@ struct Subtraction : public Computation {
                                 const Expression& term2);
 
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns an instantiation of this expression. */
   virtual const Expression& instantiation(const SubstitutionMap& subst,
@@ -246,7 +321,7 @@ struct Multiplication : public Computation {
                                 const Expression& factor2);
 
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns an instantiation of this expression. */
   virtual const Expression& instantiation(const SubstitutionMap& subst,
@@ -275,7 +350,7 @@ struct Division : public Computation {
                                 const Expression& factor2);
 
   /* Returns the value of this expression in the given state. */
-  virtual Rational value(const ValueMap& values) const;
+  virtual Number value(const ValueMap& values) const;
 
   /* Returns an instantiation of this expression. */
   virtual const Expression& instantiation(const SubstitutionMap& subst,
@@ -292,13 +367,154 @@ struct Division : public Computation {
 };
 
 
+/* ====================================================================== */
+/* FluentList */
+
+/*
+ * List of fluents.
+ */
+struct FluentList : public std::vector<const Fluent*> {
+};
+
+
 /* ====================================================================== */
 /* ValueMap */
 
 /*
- * Mapping from fluents to values.
+ * Mapping from ground fluents to values, stored as a flat array
+ * indexed by fluent index.
  */
-struct ValueMap : public std::map<const Fluent*, Rational> {
+struct ValueMap {
+  /* A fluent and its value. */
+  typedef std::pair<const Fluent*, Number> value_type;
+
+  /*
+   * Iterator over the entries of a value map, in index order.
+   */
+  struct const_iterator {
+    /* Returns the entry pointed to by this iterator. */
+    const value_type& operator*() const { return *entry_; }
+
+    /* Returns a pointer to the entry pointed to by this iterator. */
+    const value_type* operator->() const { return entry_; }
+
+    /* Advances this iterator to the next entry. */
+    const_iterator& operator++() {
+      entry_ = skip(entry_ + 1, last_);
+      return *this;
+    }
+
+    /* Advances this iterator to the next entry. */
+    const_iterator operator++(int) {
+      const_iterator ci = *this;
+      ++*this;
+      return ci;
+    }
+
+    /* Equality operator for iterators. */
+    bool operator==(const const_iterator& ci) const {
+      return entry_ == ci.entry_;
+    }
+
+    /* Inequality operator for iterators. */
+    bool operator!=(const const_iterator& ci) const {
+      return entry_ != ci.entry_;
+    }
+
+   private:
+    /* The current entry. */
+    const value_type* entry_;
+    /* Pointer beyond the last entry. */
+    const value_type* last_;
+
+    /* Constructs an iterator pointing to the given entry. */
+    const_iterator(const value_type* entry, const value_type* last)
+      : entry_(entry), last_(last) {}
+
+    /* Returns the first defined entry in the given range, or last if
+       there is no such entry. */
+    static const value_type* skip(const value_type* entry,
+                                  const value_type* last) {
+      while (entry != last && entry->first == 0) {
+        entry++;
+      }
+      return entry;
+    }
+
+    friend struct ValueMap;
+  };
+
+  typedef const_iterator iterator;
+
+  /* Constructs an empty value map. */
+  ValueMap() : size_(0) {}
+
+  /* Returns a const_iterator pointing to the first entry. */
+  const_iterator begin() const {
+    return const_iterator(const_iterator::skip(first(), last()), last());
+  }
+
+  /* Returns a const_iterator pointing beyond the last entry. */
+  const_iterator end() const { return const_iterator(last(), last()); }
+
+  /* Tests if this value map is empty. */
+  bool empty() const { return size_ == 0; }
+
+  /* Returns the number of fluents with a value in this map. */
+  size_t size() const { return size_; }
+
+  /* Returns a const_iterator pointing to the entry for the given
+     fluent, or end() if the fluent has no value in this map. */
+  const_iterator find(const Fluent* fluent) const {
+    if (fluent->indexed() && fluent->index() < entries_.size()) {
+      const value_type* entry = first() + fluent->index();
+      if (entry->first != 0) {
+        return const_iterator(entry, last());
+      }
+    }
+    return end();
+  }
+
+  /* Returns the value of the fluent with the given index, or 0 if the
+     fluent has no value in this map. */
+  const Number* value(size_t index) const {
+    if (index < entries_.size() && entries_[index].first != 0) {
+      return &entries_[index].second;
+    } else {
+      return 0;
+    }
+  }
+
+  /* Returns the value of the given fluent, adding the fluent with
+     value 0 if it has no value in this map. */
+  Number& operator[](const Fluent* fluent) {
+    return entry(fluent).second;
+  }
+
+  /* Adds the given entry to this map, unless the fluent already has
+     a value. */
+  std::pair<const_iterator, bool> insert(const value_type& value);
+
+  /* Removes all entries from this map. */
+  void clear() { entries_.clear(); size_ = 0; }
+
+ private:
+  /* Entries indexed by fluent index, with a null fluent for
+     undefined entries. */
+  std::vector<value_type> entries_;
+  /* Number of defined entries. */
+  size_t size_;
+
+  /* Returns a pointer to the first entry. */
+  const value_type* first() const {
+    return entries_.empty() ? 0 : &entries_[0];
+  }
+
+  /* Returns a pointer beyond the last entry. */
+  const value_type* last() const { return first() + entries_.size(); }
+
+  /* Returns the entry for the given fluent, adding it if needed. */
+  value_type& entry(const Fluent* fluent);
 };
 
 
@@ -184,58 +184,111 @@ std::ostream& operator<<(std::ostream& os, const StateFormula& f) {
 /* Atom */
 
 /* Table of atoms. */
-Atom::AtomTable Atom::atoms;
-
-
-/* Comparison function. */
-bool Atom::AtomLess::operator()(const Atom* a1, const Atom* a2) const {
-  if (a1->predicate() < a2->predicate()) {
-    return true;
-  } else if (a2->predicate() < a1->predicate()) {
-    return false;
-  } else {
-    return a1->terms() < a2->terms();
+InternTable<Atom> Atom::atoms;
+/* Indexed atoms, with 0 in place of deleted atoms. */
+std::vector<const Atom*> Atom::indexed_atoms;
+/* Guards the table of atoms. */
+std::mutex Atom::table_mutex;
+/* Whether atoms added to the table are pinned. */
+bool Atom::pinning = false;
+/* Atoms pinned since pin_all() was called. */
+std::vector<const Atom*> Atom::pinned_atoms;
+
+
+/* Returns the hash value of a atom with the given predicate and
+   terms. */
+size_t Atom::hash(Predicate predicate, const TermList& terms) {
+  uint64_t h = std::hash<Predicate>()(predicate);
+  for (TermList::const_iterator ti = terms.begin(); ti != terms.end(); ti++) {
+    h = (h ^ std::hash<Term>()(*ti))*0x9e3779b97f4a7c15ULL;
   }
+  /* The table picks slots with the low bits, so mix in the high bits. */
+  h = (h ^ (h >> 31))*0xbf58476d1ce4e5b9ULL;
+  return h ^ (h >> 29);
 }
 
 
-/* Returns an atom with the given predicate and terms. */
+/* Returns a atom with the given predicate and terms. */
 const Atom& Atom::make(Predicate predicate, const TermList& terms) {
-  Atom* atom = new Atom(predicate);
   bool ground = true;
   for (TermList::const_iterator ti = terms.begin(); ti != terms.end(); ti++) {
-    atom->add_term(*ti);
-    if (ground && (*ti).variable()) {
+    if ((*ti).variable()) {
       ground = false;
+      break;
     }
   }
   if (!ground) {
+    Atom* atom = new Atom(predicate);
+    atom->terms_ = terms;
     return *atom;
-  } else {
-    std::pair<AtomTable::const_iterator, bool> result = atoms.insert(atom);
-    if (!result.second) {
-      delete atom;
-      return **result.first;
-    } else {
-      return *atom;
-    }
   }
+  size_t h = hash(predicate, terms);
+  std::lock_guard<std::mutex> lock(table_mutex);
+  const Atom* old_atom = atoms.find(h, [&](const Atom* a) {
+      return a->predicate() == predicate && a->terms() == terms;
+    });
+  if (old_atom != 0) {
+    return *old_atom;
+  }
+  Atom* atom = new Atom(predicate);
+  atom->terms_ = terms;
+  atoms.insert(atom, h);
+  if (pinning) {
+    ref(atom);
+    pinned_atoms.push_back(atom);
+  }
+  return *atom;
 }
 
 
 /* Deletes this atom. */
 Atom::~Atom() {
-  AtomTable::const_iterator ai = atoms.find(this);
-  if (*ai == this) {
-    atoms.erase(ai);
+  std::lock_guard<std::mutex> lock(table_mutex);
+  atoms.erase(this, hash(predicate(), terms()));
+  if (indexed()) {
+    indexed_atoms[index_] = 0;
+  }
+}
+
+
+/* Keeps every ground atom added to the table from now on alive until
+   unpin_all() is called. */
+void Atom::pin_all() {
+  std::lock_guard<std::mutex> lock(table_mutex);
+  pinning = true;
+}
+
+
+/* Releases the atoms pinned since pin_all() was called. */
+void Atom::unpin_all() {
+  std::vector<const Atom*> pinned;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex);
+    pinning = false;
+    pinned.swap(pinned_atoms);
   }
+  for (std::vector<const Atom*>::const_iterator ai = pinned.begin();
+       ai != pinned.end(); ai++) {
+    destructive_deref(*ai);
+  }
+}
+
+
+/* Returns the index of this atom, assigning the next free index to
+   this atom if it has none.  Only ground atoms can be indexed. */
+size_t Atom::index() const {
+  if (!indexed()) {
+    index_ = indexed_atoms.size();
+    indexed_atoms.push_back(this);
+  }
+  return index_;
 }
 
 
 /* Tests if this state formula holds in the given state. */
 bool Atom::holds(const TermTable& terms,
                  const AtomSet& atoms, const ValueMap& values) const {
-  return atoms.find(this) != atoms.end();
+  return atoms.contains(*this);
 }
 
 
@@ -270,7 +323,7 @@ const StateFormula& Atom::instantiation(const SubstitutionMap& subst,
                                         bool state) const {
   if (this->terms().empty()) {
     if (state || PredicateTable::static_predicate(predicate())) {
-      if (atoms.find(this) != atoms.end()) {
+      if (atoms.contains(*this)) {
         return TRUE;
       } else {
         return FALSE;
@@ -301,7 +354,7 @@ const StateFormula& Atom::instantiation(const SubstitutionMap& subst,
       const Atom& inst_atom = make(predicate(), inst_terms);
       if ((state || PredicateTable::static_predicate(predicate()))
           && objects == inst_terms.size()) {
-        if (atoms.find(&inst_atom) != atoms.end()) {
+        if (atoms.contains(inst_atom)) {
           return TRUE;
         } else {
           return FALSE;
@@ -873,7 +926,10 @@ bool Exists::holds(const TermTable& terms,
                    const AtomSet& atoms, const ValueMap& values) const {
   const StateFormula& inst_exists =
     instantiation(SubstitutionMap(), terms, atoms, values, true);
-  return inst_exists.tautology();
+  bool result = inst_exists.tautology();
+  ref(&inst_exists);
+  destructive_deref(&inst_exists);
+  return result;
 }
 
 
@@ -975,7 +1031,10 @@ bool Forall::holds(const TermTable& terms,
                    const AtomSet& atoms, const ValueMap& values) const {
   const StateFormula& inst_forall =
     instantiation(SubstitutionMap(), terms, atoms, values, true);
-  return inst_forall.tautology();
+  bool result = inst_forall.tautology();
+  ref(&inst_forall);
+  destructive_deref(&inst_forall);
+  return result;
 }
 
 
@@ -1056,3 +1115,83 @@ void Forall::print(std::ostream& os) const {
   }
   os << ") " << body() << ")";
 }
+
+
+/* ====================================================================== */
+/* AtomSet */
+
+/* Inserts the given atom into this set. */
+std::pair<AtomSet::const_iterator, bool> AtomSet::insert(const Atom* atom) {
+  size_t index = atom->index();
+  if (index >= capacity()) {
+    bits_.resize(index/WORD_BITS + 1, 0);
+  }
+  Word mask = Word(1) << (index%WORD_BITS);
+  Word& word = bits_[index/WORD_BITS];
+  bool inserted = (word & mask) == 0;
+  if (inserted) {
+    word |= mask;
+    size_++;
+  }
+  return std::make_pair(const_iterator(*this, index), inserted);
+}
+
+
+/* Removes the given atom from this set.  Returns the number of
+   removed atoms. */
+size_t AtomSet::erase(const Atom* atom) {
+  if (!contains(*atom)) {
+    return 0;
+  } else {
+    size_t index = atom->index();
+    bits_[index/WORD_BITS] &= ~(Word(1) << (index%WORD_BITS));
+    size_--;
+    return 1;
+  }
+}
+
+
+/* Removes the atoms with the given bits from, and then adds the atoms
+   with the given bits to, the word of the bitset with the given index.
+   Returns the bits of the word before the change. */
+AtomSet::Word AtomSet::change_word(size_t index, Word deletes, Word adds) {
+  if (index >= bits_.size()) {
+    if (adds == 0) {
+      return 0;
+    }
+    bits_.resize(index + 1, 0);
+  }
+  Word old_bits = bits_[index];
+  Word bits = (old_bits & ~deletes) | adds;
+  bits_[index] = bits;
+  size_ = size_ - __builtin_popcountl(old_bits) + __builtin_popcountl(bits);
+  return old_bits;
+}
+
+
+/* Returns the index of the first atom in this set with an index
+   greater than or equal to the given index, or capacity() if there is
+   no such atom. */
+size_t AtomSet::next_index(size_t index) const {
+  size_t n = bits_.size();
+  size_t w = index/WORD_BITS;
+  if (w >= n) {
+    return capacity();
+  }
+  Word word = bits_[w] & (~Word(0) << (index%WORD_BITS));
+  while (true) {
+    while (word == 0) {
+      w++;
+      if (w == n) {
+        return capacity();
+      }
+      word = bits_[w];
+    }
+    size_t i = w*WORD_BITS + __builtin_ctzl(word);
+    if (Atom::indexed_atom(i) != 0) {
+      return i;
+    }
+    /* Skip bits left behind by deleted atoms. */
+    word &= word - 1;
+  }
+}
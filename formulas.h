@@ -23,10 +23,15 @@
 #include <config.h>
 #include "expressions.h"
 #include "refcount.h"
+#include "interntable.h"
 #include "predicates.h"
 #include "terms.h"
+#include <climits>
+#include <cstddef>
 #include <iostream>
+#include <mutex>
 #include <set>
+#include <utility>
 #include <vector>
 
 #ifdef TRUE
@@ -105,6 +110,24 @@ struct Atom : public StateFormula {
   /* Returns an atom with the given predicate and terms. */
   static const Atom& make(Predicate predicate, const TermList& terms);
 
+  /* Returns the atom with the given index, or 0 if no such atom
+     exists. */
+  static const Atom* indexed_atom(size_t index) {
+    return (index < indexed_atoms.size()) ? indexed_atoms[index] : 0;
+  }
+
+  /* Returns the number of indices assigned to atoms. */
+  static size_t num_indexed() { return indexed_atoms.size(); }
+
+  /* Keeps every ground atom added to the table from now on alive
+     until unpin_all() is called.  While atoms are pinned, make() can
+     be called from several threads at once, provided that the atoms
+     that already exist are kept alive by their owners. */
+  static void pin_all();
+
+  /* Releases the atoms pinned since pin_all() was called. */
+  static void unpin_all();
+
   /* Deletes this atom. */
   virtual ~Atom();
 
@@ -114,6 +137,13 @@ struct Atom : public StateFormula {
   /* Returns the terms of this atom. */
   const TermList& terms() const { return terms_; }
 
+  /* Tests if this atom has been assigned an index. */
+  bool indexed() const { return index_ != NO_INDEX; }
+
+  /* Returns the index of this atom, assigning the next free index to
+     this atom if it has none.  Only ground atoms can be indexed. */
+  size_t index() const;
+
   /* Tests if this state formula holds in the given state. */
   virtual bool holds(const TermTable& terms,
                      const AtomSet& atoms, const ValueMap& values) const;
@@ -133,30 +163,34 @@ struct Atom : public StateFormula {
   virtual void print(std::ostream& os) const;
 
  private:
-  /* Less-than comparison function object for atoms. */
-  struct AtomLess
-    : public std::binary_function<const Atom*, const Atom*, bool> {
-    /* Comparison function. */
-    bool operator()(const Atom* a1, const Atom* a2) const;
-  };
+  /* Returns the hash value of a atom with the given predicate and
+     terms. */
+  static size_t hash(Predicate predicate, const TermList& terms);
 
-  /* A table of atoms. */
-  struct AtomTable : std::set<const Atom*, AtomLess> {
-  };
+  /* Index of atoms that have not been assigned an index. */
+  static const size_t NO_INDEX = size_t(-1);
 
   /* Table of atoms. */
-  static AtomTable atoms;
+  static InternTable<Atom> atoms;
+  /* Indexed atoms, with 0 in place of deleted atoms. */
+  static std::vector<const Atom*> indexed_atoms;
+  /* Guards the table of atoms. */
+  static std::mutex table_mutex;
+  /* Whether atoms added to the table are pinned. */
+  static bool pinning;
+  /* Atoms pinned since pin_all() was called. */
+  static std::vector<const Atom*> pinned_atoms;
 
   /* Predicate of this atom. */
   Predicate predicate_;
   /* Terms of this atom. */
   TermList terms_;
+  /* Index of this atom in atom sets. */
+  mutable size_t index_;
 
   /* Constructs an atom with the given predicate. */
-  explicit Atom(Predicate predicate) : predicate_(predicate) {}
-
-  /* Adds a term to this atom. */
-  void add_term(const Term& term) { terms_.push_back(term); }
+  explicit Atom(Predicate predicate)
+    : predicate_(predicate), index_(NO_INDEX) {}
 };
 
 
@@ -620,9 +654,138 @@ struct Forall : public Quantification {
 /* AtomSet */
 
 /*
- * A set of atoms.
+ * A set of ground atoms, represented as a bitset over atom indices.
  */
-struct AtomSet : public std::set<const Atom*> {
+struct AtomSet {
+  /* A word of the bitset. */
+  typedef unsigned long Word;
+
+  /* Number of bits in a word. */
+  static const size_t WORD_BITS = sizeof(Word)*CHAR_BIT;
+
+  /*
+   * Iterator over the atoms of an atom set, in index order.
+   */
+  struct const_iterator {
+    /* Returns the atom pointed to by this iterator. */
+    const Atom* operator*() const { return Atom::indexed_atom(index_); }
+
+    /* Advances this iterator to the next atom. */
+    const_iterator& operator++() {
+      index_ = set_->next_index(index_ + 1);
+      return *this;
+    }
+
+    /* Advances this iterator to the next atom. */
+    const_iterator operator++(int) {
+      const_iterator ci = *this;
+      ++*this;
+      return ci;
+    }
+
+    /* Equality operator for iterators. */
+    bool operator==(const const_iterator& ci) const {
+      return index_ == ci.index_;
+    }
+
+    /* Inequality operator for iterators. */
+    bool operator!=(const const_iterator& ci) const {
+      return index_ != ci.index_;
+    }
+
+   private:
+    /* The atom set iterated over. */
+    const AtomSet* set_;
+    /* Index of the current atom. */
+    size_t index_;
+
+    /* Constructs an iterator pointing to the atom with the given index. */
+    const_iterator(const AtomSet& set, size_t index)
+      : set_(&set), index_(index) {}
+
+    friend struct AtomSet;
+  };
+
+  typedef const_iterator iterator;
+
+  /* Constructs an empty atom set. */
+  AtomSet() : size_(0) {}
+
+  /* Returns a const_iterator pointing to the first atom. */
+  const_iterator begin() const { return const_iterator(*this, next_index(0)); }
+
+  /* Returns a const_iterator pointing beyond the last atom. */
+  const_iterator end() const { return const_iterator(*this, capacity()); }
+
+  /* Tests if this atom set is empty. */
+  bool empty() const { return size_ == 0; }
+
+  /* Returns the number of atoms in this atom set. */
+  size_t size() const { return size_; }
+
+  /* Tests if this atom set contains the given atom. */
+  bool contains(const Atom& atom) const {
+    return atom.indexed() && test(atom.index());
+  }
+
+  /* Tests if this atom set contains the atom with the given index. */
+  bool contains(size_t index) const { return test(index); }
+
+  /* Returns a const_iterator pointing to the given atom, or end() if
+     the atom is not in this set. */
+  const_iterator find(const Atom* atom) const {
+    return contains(*atom) ? const_iterator(*this, atom->index()) : end();
+  }
+
+  /* Inserts the given atom into this set. */
+  std::pair<const_iterator, bool> insert(const Atom* atom);
+
+  /* Inserts the given range of atoms into this set. */
+  template<typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    for (; first != last; ++first) {
+      insert(*first);
+    }
+  }
+
+  /* Removes the given atom from this set.  Returns the number of
+     removed atoms. */
+  size_t erase(const Atom* atom);
+
+  /* Removes all atoms from this set. */
+  void clear() { bits_.clear(); size_ = 0; }
+
+  /* Returns the number of words of the bitset.  Words beyond the last
+     word of the bitset have no bits set. */
+  size_t num_words() const { return bits_.size(); }
+
+  /* Returns the word of the bitset with the given index. */
+  Word word(size_t index) const { return bits_[index]; }
+
+  /* Removes the atoms with the given bits from, and then adds the
+     atoms with the given bits to, the word of the bitset with the
+     given index.  Returns the bits of the word before the change. */
+  Word change_word(size_t index, Word deletes, Word adds);
+
+ private:
+  /* Bitset over atom indices. */
+  std::vector<Word> bits_;
+  /* Number of atoms in this set. */
+  size_t size_;
+
+  /* Returns the number of atom indices covered by the bitset. */
+  size_t capacity() const { return bits_.size()*WORD_BITS; }
+
+  /* Tests if the bit for the given atom index is set. */
+  bool test(size_t index) const {
+    return (index < capacity()
+            && (bits_[index/WORD_BITS] >> (index%WORD_BITS)) & 1);
+  }
+
+  /* Returns the index of the first atom in this set with an index
+     greater than or equal to the given index, or capacity() if there
+     is no such atom. */
+  size_t next_index(size_t index) const;
 };
 
 
@@ -22,6 +22,7 @@
 
 #include <config.h>
 #include "types.h"
+#include <functional>
 #include <iostream>
 #include <map>
 #include <set>
@@ -47,6 +48,7 @@ struct Function {
   friend bool operator<(const Function& f1, const Function& f2);
   friend std::ostream& operator<<(std::ostream& os, const Function& f);
   friend struct FunctionTable;
+  friend struct std::hash<Function>;
 };
 
 /* Equality operator for functions. */
@@ -67,6 +69,17 @@ inline bool operator<(const Function& f1, const Function& f2) {
 /* Output operator for functions. */
 std::ostream& operator<<(std::ostream& os, const Function& f);
 
+/*
+ * Hash function object for functions.
+ */
+namespace std {
+template<>
+struct hash<Function> {
+  /* Hash function operator. */
+  size_t operator()(const Function& f) const { return f.index_; }
+};
+}
+
 
 /* ====================================================================== */
 /* FunctionSet */
@@ -106,6 +119,11 @@ struct FunctionTable {
      function with the given name exists. */
   const Function* find_function(const std::string& name) const;
 
+  /* Returns the functions of this table, keyed by name. */
+  const std::map<std::string, Function>& functions() const {
+    return functions_;
+  }
+
  private:
   /* Function names. */
   static std::vector<std::string> names_;
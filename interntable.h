@@ -0,0 +1,130 @@
+/* -*-C++-*- */
+/*
+ * Hash tables for interned objects.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INTERNTABLE_H
+#define INTERNTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/* ====================================================================== */
+/* InternTable */
+
+/*
+ * An open-addressing hash table of pointers to interned objects.  The
+ * table stores the hash value of every object next to the pointer, so
+ * that a lookup only has to compare objects whose hash values match.
+ * Every object must be added with the same hash value that is later
+ * used to find or remove it.  Collisions are resolved by linear
+ * probing, and removed objects leave a tombstone behind until the
+ * table is next rebuilt.
+ */
+template<typename T>
+struct InternTable {
+  /* Constructs an empty table. */
+  InternTable() : slots_(16), used_(0), size_(0) {}
+
+  /* Returns the number of objects in this table. */
+  size_t size() const { return size_; }
+
+  /* Returns the object with the given hash value for which the given
+     predicate holds, or 0 if there is no such object. */
+  template<typename Matches>
+  const T* find(size_t hash, Matches matches) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; slots_[i].object != 0; i = (i + 1) & mask) {
+      if (slots_[i].hash == hash && slots_[i].object != TOMBSTONE()
+          && matches(slots_[i].object)) {
+        return slots_[i].object;
+      }
+    }
+    return 0;
+  }
+
+  /* Adds the given object with the given hash value to this table.
+     The table must not already contain a matching object. */
+  void insert(const T* object, size_t hash) {
+    if (2*(used_ + 1) > slots_.size()) {
+      rebuild(4*(size_ + 1) > slots_.size() ? 2*slots_.size()
+              : slots_.size());
+    }
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i].object != 0) {
+      i = (i + 1) & mask;
+    }
+    slots_[i].hash = hash;
+    slots_[i].object = object;
+    used_++;
+    size_++;
+  }
+
+  /* Removes the given object with the given hash value from this
+     table, if the table contains it. */
+  void erase(const T* object, size_t hash) {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; slots_[i].object != 0; i = (i + 1) & mask) {
+      if (slots_[i].object == object) {
+        slots_[i].object = TOMBSTONE();
+        size_--;
+        return;
+      }
+    }
+  }
+
+ private:
+  /* A slot in the table. */
+  struct Slot {
+    /* Hash value of the object in this slot. */
+    size_t hash;
+    /* Object in this slot, 0 if the slot has never been used, or
+       TOMBSTONE() if the object has been removed. */
+    const T* object;
+
+    Slot() : hash(0), object(0) {}
+  };
+
+  /* Returns the marker for slots with removed objects. */
+  static const T* TOMBSTONE() {
+    return reinterpret_cast<const T*>(uintptr_t(1));
+  }
+
+  /* Slots of this table; the number of slots is a power of two. */
+  std::vector<Slot> slots_;
+  /* Number of slots that are not empty, including tombstones. */
+  size_t used_;
+  /* Number of objects in this table. */
+  size_t size_;
+
+  /* Rehashes all objects into the given number of slots, dropping
+     tombstones. */
+  void rebuild(size_t num_slots) {
+    std::vector<Slot> slots(num_slots);
+    slots.swap(slots_);
+    used_ = size_ = 0;
+    for (typename std::vector<Slot>::const_iterator si = slots.begin();
+         si != slots.end(); si++) {
+      if ((*si).object != 0 && (*si).object != TOMBSTONE()) {
+        insert((*si).object, (*si).hash);
+      }
+    }
+  }
+};
+
+
+#endif /* INTERNTABLE_H */
@@ -20,6 +20,7 @@
 #include "problems.h"
 #include "domains.h"
 #include "actions.h"
+#include "snapshots.h"
 #include <cstdlib>
 #include <iostream>
 #include <cerrno>
@@ -52,24 +53,36 @@ int verbosity;
 
 /* Program options. */
 static struct option long_options[] = {
+  { "binary", no_argument, 0, 'b' },
+  { "load-grounded", required_argument, 0, 'g' },
   { "host", required_argument, 0, 'H' },
   { "port", required_argument, 0, 'P' },
+  { "prune-unreachable", no_argument, 0, 'u' },
   { "verbose", optional_argument, 0, 'v' },
   { "warnings", optional_argument, 0, 'W' },
   { "help", no_argument, 0, 'h' },
   { 0, 0, 0, 0 }
 };
-static const char OPTION_STRING[] = "H:P:v::W::h";
+static const char OPTION_STRING[] = "bg:H:P:uv::W::h";
 
 
 /* Displays help. */
 static void display_help() {
   std::cout << "usage: mdpclient [options] [file ...]" << std::endl
             << "options:" << std::endl
+            << "  -b,    --binary\t"
+            << "use binary frames instead of XML messages" << std::endl
+            << "  -g f,  --load-grounded=f" << std::endl
+            << "\t\t\tload grounded problems from snapshot f" << std::endl
             << "  -H h,  --host=h\t"
             << "connect to host h" << std::endl
             << "  -P p,  --port=p\t"
             << "connect to port p" << std::endl
+            << "  -u,    --prune-unreachable" << std::endl
+            << "\t\t\tdrop actions that are unreachable from the initial"
+            << std::endl
+            << "\t\t\t  state even when delete effects are ignored"
+            << std::endl
             << "  -v[n], --verbose[=n]\t"
             << "use verbosity level n;" << std::endl
             << "\t\t\t  n is a number from 0 (verbose mode off) and up;"
@@ -138,12 +151,15 @@ int connect(const char *hostname, int port)
 class RandomPlanner : public Planner
 {
  public:
-  RandomPlanner(const Problem& problem) : Planner(problem) { srand(time(0)); }
+  RandomPlanner(const Problem& problem)
+    : Planner(problem), _random(time(0)) {}
   virtual void initRound();
   virtual ~RandomPlanner() {}
   virtual const Action* decideAction(const AtomSet& atoms,
                                      const ValueMap& values);
   virtual void endRound();
+ private:
+  Random _random;
 };
 
 void RandomPlanner::initRound()
@@ -166,8 +182,7 @@ const Action* RandomPlanner::decideAction(const AtomSet& atoms,
     return 0;
   }
   else {
-    size_t i = size_t(rand()/(RAND_MAX + 1.0)*actions.size());
-    return actions[i];
+    return actions[_random.below(actions.size())];
   }
 }
 
@@ -181,6 +196,10 @@ int main(int argc, char **argv)
   std::string host;
   /* Port. */
   int port = 0;
+  /* Whether to use binary frames. */
+  bool binary = false;
+  /* Snapshot of grounded problems to load, if any. */
+  std::string snapshot;
 
   try {
     /*
@@ -194,12 +213,21 @@ int main(int argc, char **argv)
         break;
       }
       switch (c) {
+      case 'b':
+        binary = true;
+        break;
+      case 'g':
+        snapshot = optarg;
+        break;
       case 'H':
         host = optarg;
         break;
       case 'P':
         port = atoi(optarg);
         break;
+      case 'u':
+        Problem::prune_unreachable = true;
+        break;
       case 'v':
         verbosity = (optarg != 0) ? atoi(optarg) : 1;
         break;
@@ -220,6 +248,9 @@ int main(int argc, char **argv)
     /*
      * Read pddl files.
      */
+    if (!snapshot.empty()) {
+      load_grounded(snapshot);
+    }
     if (optind < argc) {
       /*
        * Use remaining command line arguments as file names.
@@ -229,7 +260,7 @@ int main(int argc, char **argv)
           return -1;
         }
       }
-    } else {
+    } else if (snapshot.empty()) {
       /*
        * No remaining command line argument, so read from standard input.
        */
@@ -267,7 +298,7 @@ int main(int argc, char **argv)
     for (Problem::ProblemMap::const_iterator pi = Problem::begin();
          pi != Problem::end(); pi++) {
       RandomPlanner p(*(*pi).second);
-      XMLClient(p, *(*pi).second, "johnclient", socket);
+      XMLClient(p, *(*pi).second, "johnclient", socket, binary);
     }
   } catch (const std::exception& e) {
     std::cerr << std::endl << "mdpclient: " << e.what() << std::endl;
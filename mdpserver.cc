@@ -25,14 +25,19 @@
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <sstream>
 
 #if !HAVE_SOCKLEN_T
 # if !defined(__sgi) || defined(_NO_XOPEN4)
@@ -88,6 +93,171 @@ static const Action* make_action(const str_vec& params,
 }
 
 
+/* Mutex protecting the dictionary frames. */
+static std::mutex dictionary_mutex;
+
+
+/* Appends the names of the given terms to the given frame. */
+static void append_terms(std::string& out, const TermList& terms) {
+  append_u32(out, terms.size());
+  for (TermList::const_iterator ti = terms.begin(); ti != terms.end(); ti++) {
+    std::ostringstream os;
+    os << *ti;
+    append_string(out, os.str());
+  }
+}
+
+
+/* Returns the dictionary frame for the given problem.  The frame lists
+   the id, predicate, and terms of each atom in states of the problem,
+   the id, function, and terms of each fluent in states, and the id,
+   name, and arguments of each action.  The frame is built once per
+   problem. */
+static const std::string& dictionary_frame(const Problem& problem) {
+  static std::map<const Problem*, std::string> dictionaries;
+  std::lock_guard<std::mutex> lock(dictionary_mutex);
+  std::string& out = dictionaries[&problem];
+  if (!out.empty()) {
+    return out;
+  }
+  size_t frame = begin_frame(out, DICTIONARY_FRAME);
+  size_t count = out.size();
+  uint32_t n = 0;
+  append_u32(out, n);
+  for (size_t i = 0; i < Atom::num_indexed(); i++) {
+    const Atom* atom = Atom::indexed_atom(i);
+    if (atom != 0 && problem.observable(*atom)) {
+      append_u32(out, i);
+      append_string(out, PredicateTable::name(atom->predicate()));
+      append_terms(out, atom->terms());
+      n++;
+    }
+  }
+  set_u32(out, count, n);
+  count = out.size();
+  n = 0;
+  append_u32(out, n);
+  for (size_t i = 0; i < Fluent::num_indexed(); i++) {
+    const Fluent* fluent = Fluent::indexed_fluent(i);
+    if (fluent != 0 && problem.observable(*fluent)) {
+      append_u32(out, i);
+      append_string(out, FunctionTable::name(fluent->function()));
+      append_terms(out, fluent->terms());
+      n++;
+    }
+  }
+  set_u32(out, count, n);
+  append_u32(out, problem.actions().size());
+  for (ActionSet::const_iterator ai = problem.actions().begin();
+       ai != problem.actions().end(); ai++) {
+    const Action& action = **ai;
+    append_u32(out, action.index());
+    append_string(out, action.name());
+    append_u32(out, action.arguments().size());
+    for (ObjectList::const_iterator oi = action.arguments().begin();
+         oi != action.arguments().end(); oi++) {
+      std::ostringstream os;
+      os << *oi;
+      append_string(out, os.str());
+    }
+  }
+  end_frame(out, frame);
+  return out;
+}
+
+
+/* Appends the given fluent value to the given frame.  A double value
+   is sent as its bit pattern in place of the numerator, with a
+   denominator of 0. */
+static void append_value(std::string& out,
+                         const Fluent& fluent, const Number& value) {
+  append_u32(out, fluent.index());
+#ifdef DOUBLE_VALUES
+  int64_t bits;
+  std::memcpy(&bits, &value, sizeof bits);
+  append_i64(out, bits);
+  append_i64(out, 0);
+#else
+  append_i64(out, value.numerator());
+  append_i64(out, value.denominator());
+#endif
+}
+
+
+/* Appends a state frame for the given state to the given string.  The
+   frame holds a flag that is 1 for a goal state, the ids of the atoms
+   in the state, and the id and value of each fluent in the state. */
+static void append_state_frame(std::string& out, const State& s) {
+  const Problem& problem = s.problem();
+  size_t frame = begin_frame(out, STATE_FRAME);
+  append_u8(out, s.goal());
+  size_t count = out.size();
+  uint32_t n = 0;
+  append_u32(out, n);
+  for (AtomSet::const_iterator ai = s.atoms().begin();
+       ai != s.atoms().end(); ai++) {
+    if (problem.observable(**ai)) {
+      append_u32(out, (*ai)->index());
+      n++;
+    }
+  }
+  set_u32(out, count, n);
+  count = out.size();
+  n = 0;
+  append_u32(out, n);
+  for (ValueMap::const_iterator vi = s.values().begin();
+       vi != s.values().end(); vi++) {
+    if (problem.observable(*vi->first)) {
+      append_value(out, *vi->first, vi->second);
+      n++;
+    }
+  }
+  set_u32(out, count, n);
+  end_frame(out, frame);
+}
+
+
+/* Appends a state delta frame for the given state to the given string,
+   given the atoms and fluents that changed in the transition to the
+   state.  The frame holds a flag that is 1 for a goal state, the ids
+   of the added atoms, the ids of the deleted atoms, and the id and
+   value of each changed fluent. */
+static void append_state_delta_frame(std::string& out, const State& s,
+                                     const AtomList& changed_atoms,
+                                     const FluentList& changed_fluents) {
+  const Problem& problem = s.problem();
+  size_t frame = begin_frame(out, STATE_DELTA_FRAME);
+  append_u8(out, s.goal());
+  for (int added = 1; added >= 0; added--) {
+    size_t count = out.size();
+    uint32_t n = 0;
+    append_u32(out, n);
+    for (AtomList::const_iterator ai = changed_atoms.begin();
+         ai != changed_atoms.end(); ai++) {
+      if (problem.observable(**ai)
+          && (s.atoms().find(*ai) != s.atoms().end()) == bool(added)) {
+        append_u32(out, (*ai)->index());
+        n++;
+      }
+    }
+    set_u32(out, count, n);
+  }
+  size_t count = out.size();
+  uint32_t n = 0;
+  append_u32(out, n);
+  for (FluentList::const_iterator fi = changed_fluents.begin();
+       fi != changed_fluents.end(); fi++) {
+    ValueMap::const_iterator vi = s.values().find(*fi);
+    if (vi != s.values().end() && problem.observable(**fi)) {
+      append_value(out, **fi, vi->second);
+      n++;
+    }
+  }
+  set_u32(out, count, n);
+  end_frame(out, frame);
+}
+
+
 /* Reads the last used client id from file. */
 static int read_last_id() {
   int id = 0;
@@ -108,11 +278,22 @@ static void write_last_id(int id) {
 }
 
 
-/* Generates a new client id. */
-static int new_id() {
+/* Mutex protecting the last used client id and the random stream for
+   sessions. */
+static std::mutex id_mutex;
+/* Random stream from which each session is given a substream. */
+static Random session_random;
+
+
+/* Generates a new client id, and sets the given random stream to a
+   substream of its own for the session of the client. */
+static int new_id(Random& random) {
+  std::lock_guard<std::mutex> lock(id_mutex);
   static int last_id = read_last_id();
   last_id++;
   write_last_id(last_id);
+  random = session_random;
+  session_random.jump();
   return last_id;
 }
 
@@ -124,14 +305,21 @@ void LogBadProblem(std::ostream& os, const std::string& problem_name) {
 
 
 /* Writes a "session-init" message to the given stream. */
-void LogSessionInit(std::ostream& os, int id, const Problem_CFG& cfg) {
+void LogSessionInit(std::ostream& os, int id, const Problem_CFG& cfg,
+                    bool delta, bool binary) {
   os << "<session-init>"
      << "<sessionID>" << id << "</sessionID>"
      << "<setting>"
      << "<rounds>" << cfg.round_limit << "</rounds>"
      << "<allowed-time>" << cfg.time_limit.count() << "</allowed-time>"
-     << "<allowed-turns>" << cfg.turn_limit << "</allowed-turns>"
-     << "</setting>"
+     << "<allowed-turns>" << cfg.turn_limit << "</allowed-turns>";
+  if (delta) {
+    os << "<delta/>";
+  }
+  if (binary) {
+    os << "<binary/>";
+  }
+  os << "</setting>"
      << "</session-init>" << std::endl;
 }
 
@@ -181,7 +369,7 @@ void LogEndRound(std::ostream& os,
 void LogEndSession(std::ostream& os,
                    int id, int rounds, int round_limit, int successes,
                    std::chrono::milliseconds total_time, int total_turns,
-                   const Rational& total_metric) {
+                   const Number& total_metric) {
   os << "<end-session>"
      << "<sessionID>" << id << "</sessionID>"
      << "<rounds>" << rounds << "</rounds>"
@@ -198,241 +386,584 @@ void LogEndSession(std::ostream& os,
   os << "</reached>"
      << "</goals>";
   if (round_limit > 0) {
-    os << "<metric-average>" << total_metric.double_value()/round_limit
+    os << "<metric-average>" << to_double(total_metric)/round_limit
        << "</metric-average>";
   }
   os << "</end-session>" << std::endl;
 }
 
 
-/* Main procedure for server. */
-static void* host_problem(void* arg) {
-  std::pair<int, Problem_CFG>* p = (std::pair<int, Problem_CFG>*) arg;
-  int client_socket = p->first;
-  const std::chrono::milliseconds time_limit = p->second.time_limit;
-  int round_limit = p->second.round_limit;
-  int turn_limit = p->second.turn_limit;
-  delete p;
+/*
+ * A client session.  A session is a state machine driven by the
+ * messages that arrive on its socket; at most one server thread
+ * handles a given session at any time.
+ */
+struct Session {
+  /* Message that the session is waiting for. */
+  enum Status { SESSION_REQUEST, ROUND_REQUEST, ACTION, CLOSING };
+
+  /* Client socket. */
+  int socket;
+  /* Message that the session is waiting for, or CLOSING if the
+     session ends once all output has been sent. */
+  Status status;
+  /* Reader for messages from the client. */
+  XMLReader reader;
+  /* Output not yet sent to the client. */
+  std::string output;
+  /* Default problem configuration. */
+  Problem_CFG default_cfg;
+  /* Problem configuration for this session. */
+  Problem_CFG cfg;
+  /* Session id. */
+  int id;
+  /* Name of the contestant. */
+  std::string contestant_name;
+  /* The problem being run. */
+  const Problem* problem;
+  /* Log for this session. */
+  std::ofstream log_out;
+  /* Time since the session was initialized. */
+  Timer session_timer;
+  /* Time since the current round was initialized. */
+  Timer round_timer;
+  /* Sum of the metric over completed rounds. */
+  Number total_metric;
+  /* Time spent in successful rounds. */
+  std::chrono::milliseconds total_time;
+  /* Turns used in successful rounds. */
+  int total_turns;
+  /* Number of successful rounds. */
+  int success_count;
+  /* Current round. */
+  int round;
+  /* Time left of the session when the current round was initialized. */
+  std::chrono::milliseconds time_left;
+  /* Current turn. */
+  int turn;
+  /* Whether the current round is still running. */
+  bool running;
+  /* Current state of a round; its storage is reused by every turn
+     and round of this session. */
+  State state;
+  /* Random stream for sampling states of this session. */
+  Random random;
+  /* Whether states after the first of a round are sent as deltas. */
+  bool delta;
+  /* Whether messages after the session-init are sent in frames. */
+  bool binary;
+  /* Atoms that changed in the last transition. */
+  AtomList changed_atoms;
+  /* Fluents that changed in the last transition. */
+  FluentList changed_fluents;
+
+  /* Constructs a session for the given client socket. */
+  Session(int socket, const Problem_CFG& default_cfg)
+    : socket(socket), status(SESSION_REQUEST), reader(socket),
+      default_cfg(default_cfg),
+      id(0), problem(0), total_metric(0),
+      total_time(std::chrono::milliseconds::zero()), total_turns(0),
+      success_count(0), round(0), time_left(), turn(0), running(false),
+      delta(false), binary(false) {}
+
+  /* Deletes this session and closes its socket. */
+  ~Session() {
+    close(socket);
+  }
+};
+
+
+/* Queues the contents of the given stream for sending to the client. */
+static void send_output(Session& session, const std::ostringstream& os) {
+  if (session.binary) {
+    size_t frame = begin_frame(session.output, XML_FRAME);
+    session.output += os.str();
+    end_frame(session.output, frame);
+  } else {
+    session.output += os.str();
+  }
+}
+
+
+/* Ends the given session. */
+static void end_session(Session& session) {
+  std::ostringstream os;
+  LogEndSession(os, session.id, session.round - 1, session.cfg.round_limit,
+                session.success_count, session.total_time,
+                session.total_turns, session.total_metric);
+  LogEndSession(session.log_out, session.id, session.round - 1,
+                session.cfg.round_limit, session.success_count,
+                session.total_time, session.total_turns,
+                session.total_metric);
+  send_output(session, os);
+  std::cout << "session " << session.id << " complete" << std::endl;
+  session.status = Session::CLOSING;
+}
+
+
+/* Ends the current round of the given session. */
+static void end_round(Session& session) {
+  const State& s = session.state;
+  session.total_metric =
+    session.total_metric + session.problem->metric_value(s.values());
+
+  const std::chrono::milliseconds time_spent = std::max(
+      std::chrono::milliseconds::zero(),
+      std::min(session.time_left,
+               session.round_timer.GetElapsedMilliseconds()));
+  int turns_used = session.turn - 1;
+  if (s.goal()) {
+    session.total_time += time_spent;
+    session.total_turns += turns_used;
+    session.success_count++;
+  }
 
   std::ostringstream os;
+  LogEndRound(os, session.id, session.round, s, time_spent, turns_used);
+  LogEndRound(session.log_out, session.id, session.round, s,
+              time_spent, turns_used);
+  send_output(session, os);
+
+  session.round++;
+  if (session.round <= session.cfg.round_limit) {
+    session.status = Session::ROUND_REQUEST;
+  } else {
+    end_session(session);
+  }
+}
+
 
-  const XMLNode* init_node = read_node(client_socket);
-  if (init_node == 0 || init_node->getName() != "session-request") {
-    if (init_node != 0) {
-      delete init_node;
+/* Sends the current state to the client of the given session if the
+   current round is still running, and otherwise ends the round. */
+static void continue_round(Session& session) {
+  const State& s = session.state;
+  if (session.running && session.turn <= session.cfg.turn_limit
+      && !s.goal()) {
+    if (session.binary) {
+      if (session.delta && session.turn > 1) {
+        append_state_delta_frame(session.output, s,
+                                 session.changed_atoms,
+                                 session.changed_fluents);
+      } else {
+        append_state_frame(session.output, s);
+      }
+      if (log_paths) {
+        s.printXML(session.log_out);
+        session.log_out << std::endl;
+      }
+    } else if (session.delta && session.turn > 1) {
+      s.printXMLDelta(session.output,
+                      session.changed_atoms, session.changed_fluents);
+      session.output += '\n';
+      if (log_paths) {
+        s.printXML(session.log_out);
+        session.log_out << std::endl;
+      }
+    } else {
+      size_t start = session.output.size();
+      s.printXML(session.output);
+      session.output += '\n';
+      if (log_paths) {
+        session.log_out.write(session.output.data() + start,
+                              session.output.size() - start);
+        session.log_out.flush();
+      }
     }
-    return 0;
+    session.status = Session::ACTION;
+  } else {
+    end_round(session);
   }
+}
 
-  std::string contestant_name;
-  if (!init_node->dissect("name", contestant_name)
-      || contestant_name.empty()) {
-    delete init_node;
-    return 0;
+
+/* Handles a session request.  Returns false if the connection should
+   be closed. */
+static bool handle_session_request(Session& session,
+                                   const XMLNode& init_node) {
+  if (init_node.getName() != "session-request") {
+    return false;
   }
 
-  std::string problem_name;
-  if (!init_node->dissect("problem", problem_name) || problem_name.empty()) {
-    delete init_node;
-    return 0;
+  if (!init_node.dissect("name", session.contestant_name)
+      || session.contestant_name.empty()) {
+    return false;
   }
 
-  delete init_node;
+  std::string problem_name;
+  if (!init_node.dissect("problem", problem_name) || problem_name.empty()) {
+    return false;
+  }
 
-  int id = new_id();
+  bool binary = init_node.getChild("binary") != 0;
+  session.delta = init_node.getChild("delta") != 0;
+  session.id = new_id(session.random);
 
-  std::cout << "Contestant " << contestant_name
-            << " running problem " << problem_name << "(" << id << ")"
-            << std::endl;
+  std::cout << "Contestant " << session.contestant_name
+            << " running problem " << problem_name << "(" << session.id
+            << ")" << std::endl;
 
   // Open log file for contestant_name in "append" mode.
   std::string log_file = log_dir;
   if (!log_dir.empty() && log_dir[log_dir.size() - 1] != '/') {
     log_file += '/';
   }
-  log_file += contestant_name+"-"+problem_name;
-  std::ofstream log_out(log_file.c_str(), std::ios::app);
+  log_file += session.contestant_name+"-"+problem_name;
+  session.log_out.open(log_file.c_str(), std::ios::app);
 
-  const Problem* problem = Problem::find(problem_name);
-  if (problem == 0) {
-    os.str("");
+  std::ostringstream os;
+  session.problem = Problem::find(problem_name);
+  if (session.problem == 0) {
     LogBadProblem(os, problem_name);
-    LogBadProblem(log_out, problem_name);
-    if (! write(client_socket, os.str().c_str(), os.str().length()))
-	EXIT_ERROR;
-    return 0;
+    LogBadProblem(session.log_out, problem_name);
+    send_output(session, os);
+    session.status = Session::CLOSING;
+    return true;
   }
 
-  Problem_CFG cfg;
   CFG_map::const_iterator cfg_itr = config_map.find(problem_name);
   if (cfg_itr != config_map.end()) {
-    cfg = cfg_itr->second;
+    session.cfg = cfg_itr->second;
   } else {
-    cfg.round_limit = round_limit;
-    cfg.time_limit = time_limit;
-    cfg.turn_limit = turn_limit;
+    session.cfg = session.default_cfg;
     std::cerr << "There is no config entry for requested problem "
               << problem_name << ", using default." << std::endl;
   }
 
-  os.str("");
-  LogSessionInit(os, id, cfg);
-  LogSessionInit(log_out, id, cfg);
-  if (! write(client_socket, os.str().c_str(), os.str().length()))
-      EXIT_ERROR;
+  LogSessionInit(os, session.id, session.cfg, session.delta, binary);
+  LogSessionInit(session.log_out, session.id, session.cfg, session.delta,
+                 binary);
+  if (binary) {
+    /* Frames follow the session-init immediately, without a newline
+       in between. */
+    std::string init = os.str();
+    session.output.append(init, 0, init.find_last_not_of('\n') + 1);
+    session.output += dictionary_frame(*session.problem);
+    session.binary = true;
+  } else {
+    send_output(session, os);
+  }
 
-  Timer session_timer;
+  session.session_timer = Timer();
+  session.round = 1;
+  if (session.round <= session.cfg.round_limit) {
+    session.status = Session::ROUND_REQUEST;
+  } else {
+    end_session(session);
+  }
+  return true;
+}
 
-  Rational total_metric = 0;
-  auto total_time = std::chrono::milliseconds::zero();
-  int total_turns;
-  int success_count = 0;
-
-  int round = 1;
-  while (round <= cfg.round_limit) {
-    const XMLNode* roundReq = read_node(client_socket);
-    if (roundReq == 0 || roundReq->getName() != "round-request") {
-      if (roundReq != 0) {
-        delete roundReq;
+
+/* Handles a round request.  Returns false if the connection should be
+   closed. */
+static bool handle_round_request(Session& session, const XMLNode& round_req) {
+  if (round_req.getName() != "round-request") {
+    return false;
+  }
+
+  session.time_left = std::max(
+      std::chrono::milliseconds::zero(),
+      session.cfg.time_limit - session.session_timer.GetElapsedMilliseconds());
+
+  std::ostringstream os;
+  LogRoundInit(os, session.id, session.round, session.time_left,
+               session.cfg.round_limit - session.round);
+  LogRoundInit(session.log_out, session.id, session.round, session.time_left,
+               session.cfg.round_limit - session.round);
+  send_output(session, os);
+
+  //create initial state
+  session.state.reset(*session.problem, session.random);
+
+  session.running = session.time_left > std::chrono::milliseconds::zero();
+  session.turn = 1;
+  session.round_timer = Timer();
+  continue_round(session);
+  return true;
+}
+
+
+/* Takes the action with the given parameters in the current state of
+   the given session, and continues the round.  The action is 0 if no
+   action with the parameters exists, and the parameters are empty if
+   the client is done.  With path logging, the action is logged as the
+   given node, or as the parameters if the node is 0. */
+static void take_action(Session& session, const Action* action,
+                        const str_vec& params, const XMLNode* actionnode) {
+  const Problem& problem = *session.problem;
+  const State& s = session.state;
+  if (params.empty()) {
+    session.running = false;
+  } else if (action == 0
+             || !action->enabled(problem.terms(), s.atoms(), s.values())) {
+    std::ostringstream os;
+    if (action == 0) {
+      LogActionError(os, "bad action", params);
+      LogActionError(session.log_out, "bad action", params);
+    } else {
+      LogActionError(os, "disabled action", params);
+      LogActionError(session.log_out, "disabled action", params);
+    }
+    send_output(session, os);
+
+    session.running = false;
+  } else if (log_paths) {
+    if (actionnode != 0) {
+      session.log_out << actionnode << std::endl;
+    } else {
+      session.log_out << "<action><name>" << params[0] << "</name>";
+      for (size_t i = 1; i < params.size(); i++) {
+        session.log_out << "<term>" << params[i] << "</term>";
       }
-      return 0;
+      session.log_out << "</action>" << std::endl;
     }
+  }
 
-    if (roundReq != 0) {
-      delete roundReq;
-    }
+  if (session.cfg.time_limit
+      <= session.session_timer.GetElapsedMilliseconds()) {
+    session.running = false;
+  }
 
-    const std::chrono::milliseconds time_left = std::max(
-        std::chrono::milliseconds::zero(),
-        cfg.time_limit - session_timer.GetElapsedMilliseconds());
-
-    os.str("");
-    LogRoundInit(os, id, round, time_left, cfg.round_limit - round);
-    LogRoundInit(log_out, id, round, time_left, cfg.round_limit - round);
-    if (! write(client_socket, os.str().c_str(), os.str().length()))
-	EXIT_ERROR;
-
-    //create initial state
-    const State *s = new State(*problem);
-
-    bool running = time_left > std::chrono::milliseconds::zero();
-    int turn = 1;
-    Timer round_timer;
-    while (running && turn <= cfg.turn_limit && !s->goal()) {
-      os.str("");
-      s->printXML(os);
-      os << std::endl;
-      if (log_paths) {
-        s->printXML(log_out);
-        log_out << std::endl;
-      }
-      if (! write(client_socket, os.str().c_str(), os.str().length()))
-	  EXIT_ERROR;
-
-      const Action *action = 0;
-      const XMLNode* actnode = read_node(client_socket);
-      if (actnode == 0) {
-        delete s;
-        std::cerr << contestant_name << " in session " << id
-                  << " issued invalid XML action; connection killed."
-                  << std::endl;
-        return 0;
-      }
+  if (session.running) {
+    session.changed_atoms.clear();
+    session.changed_fluents.clear();
+    session.state.advance(*action, session.changed_atoms,
+                          session.changed_fluents, session.random);
+    session.turn++;
+  }
+  continue_round(session);
+}
 
-      if (actnode->getName() == "done") {
-        running = false;
-      } else if (actnode->getName() == "act") {
-        const XMLNode* actionnode = actnode->getChild("action");
-        str_vec params;
-        params.push_back(actionnode->getChild("name")->getText());
-        for (int i=1; i<actionnode->size(); i++)
-          params.push_back(actionnode->getChild(i)->getText());
-
-        action = make_action(params, *problem);
-        if (action == 0
-            || !action->enabled(problem->terms(), s->atoms(), s->values())) {
-          os.str("");
-          if (action == 0) {
-            LogActionError(os, "bad action", params);
-            LogActionError(log_out, "bad action", params);
-          } else {
-            LogActionError(os, "disabled action", params);
-            LogActionError(log_out, "disabled action", params);
-          }
-          if (! write(client_socket, os.str().c_str(), os.str().length()))
-	      EXIT_ERROR;
-
-          running = false;
-        } else {
-          if (log_paths) {
-            log_out << actionnode << std::endl;
-          }
-        }
-      } else {
-        delete s;
-        std::cerr << contestant_name << " in session " << id
-                  << " issued invalid XML action; connection killed."
-                  << std::endl;
-        return 0;
-      }
 
-      delete actnode;
+/* Handles an action message.  Returns false if the connection should
+   be closed. */
+static bool handle_action(Session& session, const XMLNode* actnode) {
+  if (actnode == 0
+      || (actnode->getName() != "done" && actnode->getName() != "act")) {
+    std::cerr << session.contestant_name << " in session " << session.id
+              << " issued invalid XML action; connection killed."
+              << std::endl;
+    return false;
+  }
 
-      if (cfg.time_limit <= session_timer.GetElapsedMilliseconds()) {
-        running = false;
-      }
+  const XMLNode* actionnode = 0;
+  const Action *action = 0;
+  str_vec params;
+  if (actnode->getName() != "done") {
+    actionnode = actnode->getChild("action");
+    params.push_back(std::string(actionnode->getChild("name")->getText()));
+    for (int i=1; i<actionnode->size(); i++)
+      params.push_back(std::string(actionnode->getChild(i)->getText()));
 
-      if (running) {
-        const State& next_s = s->next(*action);
-        delete s;
-        s = &next_s;
-        turn++;
+    action = make_action(params, *session.problem);
+  }
+  take_action(session, action, params, actionnode);
+  return true;
+}
+
+
+/* Handles an action frame with the given type and contents.  Returns
+   false if the connection should be closed. */
+static bool handle_action_frame(Session& session,
+                                int type, std::string_view data) {
+  const Action* action = 0;
+  str_vec params;
+  if (type == ACTION_FRAME) {
+    FrameDecoder decoder(data);
+    uint32_t id;
+    if (!decoder.u32(id) || !decoder.empty()) {
+      return false;
+    }
+    action = session.problem->indexed_action(id);
+    if (action != 0) {
+      params.push_back(action->name());
+      for (ObjectList::const_iterator oi = action->arguments().begin();
+           oi != action->arguments().end(); oi++) {
+        std::ostringstream os;
+        os << *oi;
+        params.push_back(os.str());
       }
+    } else {
+      params.push_back("#" + std::to_string(id));
     }
+  } else if (type != DONE_FRAME) {
+    std::cerr << session.contestant_name << " in session " << session.id
+              << " issued invalid action frame; connection killed."
+              << std::endl;
+    return false;
+  }
+  take_action(session, action, params, 0);
+  return true;
+}
+
+
+/* Handles a message from the client.  A null message means that the
+   client sent malformed XML.  Returns false if the connection should
+   be closed. */
+static bool handle_message(Session& session, const XMLNode* node) {
+  switch (session.status) {
+  case Session::SESSION_REQUEST:
+    return node != 0 && handle_session_request(session, *node);
+  case Session::ROUND_REQUEST:
+    return node != 0 && handle_round_request(session, *node);
+  case Session::ACTION:
+    return handle_action(session, node);
+  default:
+    return true;
+  }
+}
 
-    total_metric = total_metric + problem->metric().value(s->values());
 
-    const std::chrono::milliseconds time_spent = std::max(
-        std::chrono::milliseconds::zero(),
-        std::min(time_left, round_timer.GetElapsedMilliseconds()));
-    int turns_used = turn - 1;
-    if (s->goal()) {
-      total_time += time_spent;
-      total_turns += turns_used;
-      success_count++;
+/* Handles a frame with the given type and contents from the client.
+   Returns false if the connection should be closed. */
+static bool handle_frame(Session& session, int type, std::string_view data) {
+  if (type == XML_FRAME) {
+    return handle_message(session, session.reader.parse(data));
+  } else if (session.status == Session::ACTION) {
+    return handle_action_frame(session, type, data);
+  } else {
+    return false;
+  }
+}
+
+
+/* Reads available input for the given session and handles all
+   complete messages.  Returns false if the connection should be
+   closed. */
+static bool handle_input(Session& session) {
+  if (!session.reader.receive()) {
+    return false;
+  }
+  while (session.status != Session::CLOSING) {
+    bool handled;
+    if (session.binary) {
+      int type;
+      std::string_view data;
+      if (!session.reader.next_frame(type, data)) {
+        break;
+      }
+      handled = handle_frame(session, type, data);
+    } else {
+      const XMLNode* node;
+      if (!session.reader.next_node(node)) {
+        break;
+      }
+      handled = handle_message(session, node);
+    }
+    if (!handled) {
+      return false;
     }
+  }
+  return !session.reader.eof() || session.status == Session::CLOSING;
+}
 
-    os.str("");
-    LogEndRound(os, id, round, *s, time_spent, turns_used);
-    LogEndRound(log_out, id, round, *s, time_spent, turns_used);
-    if (! write(client_socket, os.str().c_str(), os.str().length()))
-	EXIT_ERROR;
 
-    delete s;
+/* Sends as much queued output as possible for the given session.
+   Returns false if the connection should be closed. */
+static bool handle_output(Session& session) {
+  size_t pos = 0;
+  while (pos < session.output.size()) {
+    ssize_t n = send(session.socket, session.output.data() + pos,
+                     session.output.size() - pos, MSG_NOSIGNAL);
+    if (n >= 0) {
+      pos += n;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  session.output.erase(0, pos);
+  return session.status != Session::CLOSING || !session.output.empty();
+}
 
-    round++;
+
+/* Registers the given session with the given epoll instance for the
+   next event it is waiting for. */
+static bool watch_session(int epoll_fd, int op, Session& session) {
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLONESHOT;
+  if (!session.output.empty()) {
+    event.events |= EPOLLOUT;
   }
+  event.data.ptr = &session;
+  return epoll_ctl(epoll_fd, op, session.socket, &event) == 0;
+}
 
-  os.str("");
-  LogEndSession(os, id, round - 1, cfg.round_limit,
-                success_count, total_time, total_turns, total_metric);
-  LogEndSession(log_out, id, round - 1, cfg.round_limit,
-                success_count, total_time, total_turns, total_metric);
-  if (! write(client_socket, os.str().c_str(), os.str().length()))
-      EXIT_ERROR;
 
-  std::cout << "session " << id << " complete" << std::endl;
+/* Accepts all pending connections on the given server socket. */
+static void accept_clients(int epoll_fd, int server_socket,
+                           const Problem_CFG& default_cfg) {
+  while (true) {
+    int client_socket = accept4(server_socket, 0, 0, SOCK_NONBLOCK);
+    if (client_socket < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "could not accept connection: " << strerror(errno)
+                  << std::endl;
+      }
+      break;
+    }
+    Session* session = new Session(client_socket, default_cfg);
+    if (!watch_session(epoll_fd, EPOLL_CTL_ADD, *session)) {
+      delete session;
+    }
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.ptr = 0;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, server_socket, &event);
+}
+
 
-  return 0;
+/* Main procedure for server threads.  Waits for events on the given
+   epoll instance and dispatches them to the sessions they belong to;
+   events with a null session are for the server socket. */
+static void serve_clients(int epoll_fd, int server_socket,
+                          const Problem_CFG& default_cfg) {
+  const int MAX_EVENTS = 16;
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      EXIT_ERROR;
+    }
+    for (int i = 0; i < n; i++) {
+      Session* session = static_cast<Session*>(events[i].data.ptr);
+      if (session == 0) {
+        accept_clients(epoll_fd, server_socket, default_cfg);
+        continue;
+      }
+      bool keep = true;
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        keep = handle_input(*session);
+      }
+      if (keep) {
+        keep = handle_output(*session);
+      }
+      if (!keep || !watch_session(epoll_fd, EPOLL_CTL_MOD, *session)) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->socket, 0);
+        delete session;
+      }
+    }
+  }
 }
 
 
 /* Runs a server. */
 int run_server(int port, std::chrono::milliseconds time_limit, int round_limit,
-               int turn_limit) {
+               int turn_limit, int backlog, int threads, uint64_t seed) {
   struct sockaddr_in addr;
   int server_socket;
 
+  session_random = Random(seed);
+
   std::filesystem::create_directories(log_dir);
   if ((server_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
     return -1;
@@ -452,31 +983,42 @@ int run_server(int port, std::chrono::milliseconds time_limit, int round_limit,
     return -1;
   }
 
-  if (listen(server_socket, 5)) {
+  if (listen(server_socket, backlog)) {
     std::cerr << "could not listen" << std::endl;
     return -1;
   }
+  fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+  int epoll_fd = epoll_create1(0);
+  if (epoll_fd == -1) {
+    std::cerr << "could not create epoll instance" << std::endl;
+    return -1;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.ptr = 0;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event)) {
+    std::cerr << "could not watch socket" << std::endl;
+    return -1;
+  }
 
   std::cout << "mdpsim is running a server on port " << port << std::endl;
 
-  int client_socket;
-  socklen_t addrlength = sizeof(addr);
-  while ((client_socket = accept(server_socket, (struct sockaddr*)&addr,
-                                 &addrlength)) >= 0) {
-    std::pair<int, Problem_CFG>* p = new std::pair<int, Problem_CFG>();
-    p->first = client_socket;
-    p->second.time_limit = time_limit;
-    p->second.round_limit = round_limit;
-    p->second.turn_limit = turn_limit;
-    pthread_attr_t t_attr;
-    pthread_t t_id;
-    pthread_attr_init(&t_attr);
-    if (0 == pthread_create(&t_id, &t_attr, host_problem, p)) {
-      pthread_detach(t_id);
-    }
+  Problem_CFG default_cfg;
+  default_cfg.time_limit = time_limit;
+  default_cfg.round_limit = round_limit;
+  default_cfg.turn_limit = turn_limit;
+  if (threads <= 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) {
+    workers.push_back(std::thread(serve_clients, epoll_fd, server_socket,
+                                  default_cfg));
   }
-  std::cout << client_socket << std::endl;
+  serve_clients(epoll_fd, server_socket, default_cfg);
 
+  close(epoll_fd);
   close(server_socket);
   return 0;
 }
@@ -21,13 +21,18 @@
 #define _MDPSERVER_H
 
 #include <chrono>
+#include <cstdint>
 #include <map>
 #include <string>
 
 
-/* Runs a server. */
+/* Runs a server that accepts connections with the given listen
+   backlog and serves clients using the given number of threads (or
+   one per hardware thread if not positive).  Each session samples
+   states from its own substream of a random stream with the given
+   seed. */
 int run_server(int port, std::chrono::milliseconds time_limit, int round_limit,
-               int turn_limit);
+               int turn_limit, int backlog, int threads, uint64_t seed);
 
 
 /*
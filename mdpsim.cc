@@ -20,6 +20,7 @@
 #include "problems.h"
 #include "domains.h"
 #include "mdpserver.h"
+#include "snapshots.h"
 #if HAVE_GETOPT_LONG
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -35,9 +36,14 @@
 #include <ctime>
 #include <cstring>
 #include <climits>
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 
 /* The parse function. */
@@ -60,28 +66,41 @@ bool log_paths;
 
 /* Program options. */
 static struct option long_options[] = {
+  { "backlog", required_argument, 0, 'b' },
   { "port", required_argument, 0, 'P'},
   { "configuration", required_argument, 0, 'C'},
+  { "load-grounded", required_argument, 0, 'g' },
+  { "save-grounded", required_argument, 0, 'G' },
   { "turn-limit", required_argument, 0, 'L' },
   { "log-dir", required_argument, 0, 'l' },
   { "log-paths", no_argument, 0, 'p' },
+  { "rollouts", required_argument, 0, 'r' },
   { "round-limit", required_argument, 0, 'R' },
   { "seed", required_argument, 0, 'S' },
+  { "threads", required_argument, 0, 't' },
   { "time-limit", required_argument, 0, 'T' },
+  { "prune-unreachable", no_argument, 0, 'u' },
   { "verbose", optional_argument, 0, 'v' },
   { "version", no_argument, 0, 'V' },
   { "warnings", optional_argument, 0, 'W' },
   { "help", no_argument, 0, 'h' },
   { 0, 0, 0, 0 }
 };
-static const char OPTION_STRING[] = "C:L:l:P:pR:S:T:v::VW::h";
+static const char OPTION_STRING[] = "b:C:g:G:L:l:P:pr:R:S:t:T:uv::VW::h";
 
 /* Displays help. */
 static void display_help() {
   std::cout << "usage: " << PACKAGE << " [options] [file ...]" << std::endl
             << "options:" << std::endl
+            << "  -b b,  --backlog=b\t"
+            << "use b as the listen backlog of the server" << std::endl
             << "  -C c,  --configuration=c" << std::endl
             << "\t\t\tuse configuration file c" << std::endl
+            << "  -g f,  --load-grounded=f" << std::endl
+            << "\t\t\tload grounded problems from snapshot f" << std::endl
+            << "  -G f,  --save-grounded=f" << std::endl
+            << "\t\t\tsave grounded problems to snapshot f and exit"
+            << std::endl
             << "  -L l,  --turn-limit=l\t"
             << "sets the default turn limit to l" << std::endl
             << "  -l l,  --log-dir=l\t"
@@ -90,13 +109,26 @@ static void display_help() {
             << "run the simulation as a server on port p" << std::endl
             << "  -p,    --log-paths\t"
             << "logs complete execution paths if present" << std::endl
+            << "  -r n,  --rollouts=n\t"
+            << "estimate statistics of n rollouts per problem" << std::endl
+            << "\t\t\t  instead of printing a single simulation"
+            << std::endl
             << "  -R r,  --round-limit=r" << std::endl
             << "\t\t\tsets the default round limit to r" << std::endl
             << "  -S s,  --seed=s\t"
             << "uses s as seed for random number generator" << std::endl
+            << "  -t t,  --threads=t\t"
+            << "use t threads to serve clients or run rollouts;"
+            << std::endl
+            << "\t\t\t  default is one per hardware thread" << std::endl
             << "  -T t,  --time-limit=t\t"
             << "sets the default time limit (in milliseconds) to t"
             << std::endl
+            << "  -u,    --prune-unreachable" << std::endl
+            << "\t\t\tdrop actions that are unreachable from the initial"
+            << std::endl
+            << "\t\t\t  state even when delete effects are ignored"
+            << std::endl
             << "  -v[n], --verbose[=n]\t"
             << "use verbosity level n;" << std::endl
             << "\t\t\t  n is a number from 0 (verbose mode off) and up;"
@@ -147,17 +179,148 @@ static bool read_file(const char* name) {
 }
 
 
-/* Selects an action for the given state. */
-static const Action* action_selection(const AtomSet& atoms,
-                                      const ValueMap& values,
-                                      const Problem& problem) {
-  ActionList actions;
-  problem.enabled_actions(actions, atoms, values);
+/* Selects an action among the given enabled actions using the given
+   random stream. */
+static const Action* action_selection(const ActionList& actions,
+                                      Random& random) {
   if (actions.empty()) {
     return 0;
   } else {
-    size_t i = size_t(rand()/(RAND_MAX + 1.0)*actions.size());
-    return actions[i];
+    return actions[random.below(actions.size())];
+  }
+}
+
+
+/*
+ * Statistics over a batch of rollouts.
+ */
+struct RolloutStats {
+  /* Number of rollouts. */
+  long count;
+  /* Number of rollouts that reached the goal. */
+  long goals;
+  /* Total number of turns. */
+  long long turns;
+  /* Mean of the metric. */
+  double metric_mean;
+  /* Sum of squared differences from the mean of the metric. */
+  double metric_m2;
+
+  /* Constructs statistics for an empty batch. */
+  RolloutStats()
+    : count(0), goals(0), turns(0), metric_mean(0), metric_m2(0) {}
+
+  /* Adds the outcome of a rollout to these statistics. */
+  void add(bool goal, int rollout_turns, double metric) {
+    count++;
+    if (goal) {
+      goals++;
+    }
+    turns += rollout_turns;
+    double delta = metric - metric_mean;
+    metric_mean += delta/count;
+    metric_m2 += delta*(metric - metric_mean);
+  }
+
+  /* Adds the statistics of another batch to these statistics. */
+  void add(const RolloutStats& stats) {
+    if (stats.count == 0) {
+      return;
+    }
+    long total = count + stats.count;
+    double delta = stats.metric_mean - metric_mean;
+    metric_mean += delta*stats.count/total;
+    metric_m2 += stats.metric_m2 + delta*delta*count*stats.count/total;
+    count = total;
+    goals += stats.goals;
+    turns += stats.turns;
+  }
+};
+
+
+/* Runs the given number of rollouts of a random policy for the given
+   problem using the given random stream, and adds their outcomes to
+   the given statistics. */
+static void rollout_batch(const Problem& problem, long rollouts,
+                          int turn_limit, Random random,
+                          RolloutStats& stats) {
+  ActionList actions;
+  AtomList changed_atoms;
+  FluentList changed_fluents;
+  State s;
+  for (long r = 0; r < rollouts; r++) {
+    s.reset(problem, random);
+    actions.clear();
+    problem.enabled_actions(actions, s.atoms(), s.values());
+    int time = 0;
+    while (time < turn_limit && !s.goal()) {
+      const Action* action = action_selection(actions, random);
+      if (action == 0) {
+        break;
+      }
+      changed_atoms.clear();
+      changed_fluents.clear();
+      s.advance(*action, changed_atoms, changed_fluents, random);
+      problem.update_enabled_actions(actions,
+                                     changed_atoms, changed_fluents,
+                                     s.atoms(), s.values());
+      time++;
+    }
+    stats.add(s.goal(), time,
+              to_double(problem.metric_value(s.values())));
+  }
+}
+
+
+/* Runs the given number of rollouts of a random policy for the given
+   problem, divided over the given number of threads (or one per
+   hardware thread if not positive), and prints statistics of the
+   outcomes.  Each thread uses its own substream of a random stream
+   with the given seed. */
+static void run_rollouts(const Problem& problem, long rollouts,
+                         int turn_limit, int threads, size_t seed) {
+  if (threads <= 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  if (threads > rollouts) {
+    threads = rollouts;
+  }
+  std::vector<RolloutStats> stats(threads);
+  std::vector<std::thread> workers;
+  Random random(seed);
+  for (int i = 0; i < threads; i++) {
+    long n = rollouts/threads + (i < rollouts%threads ? 1 : 0);
+    workers.push_back(std::thread(rollout_batch, std::cref(problem), n,
+                                  turn_limit, random, std::ref(stats[i])));
+    random.jump();
+  }
+  RolloutStats total;
+  for (int i = 0; i < threads; i++) {
+    workers[i].join();
+    total.add(stats[i]);
+  }
+
+  /* 95% confidence intervals: the Wilson score interval for the goal
+     rate, and the normal approximation for the mean metric. */
+  const double z = 1.959963984540054;
+  double n = total.count;
+  double p = total.goals/n;
+  double center = (p + z*z/(2*n))/(1 + z*z/n);
+  double margin = z*sqrt(p*(1 - p)/n + z*z/(4*n*n))/(1 + z*z/n);
+  std::cout << "problem `" << problem.name() << "': " << total.count
+            << " rollouts" << std::endl
+            << "  goal rate " << p << " (95% confidence interval ["
+            << center - margin << ", " << center + margin << "])"
+            << std::endl
+            << "  mean turns " << total.turns/n << std::endl;
+  if (!problem.constant_metric()) {
+    double variance = (total.count > 1) ? total.metric_m2/(n - 1) : 0;
+    double error = z*sqrt(variance/n);
+    std::cout << "  metric mean " << total.metric_mean
+              << " (95% confidence interval ["
+              << total.metric_mean - error << ", "
+              << total.metric_mean + error << "])" << std::endl
+              << "  metric variance " << variance << std::endl;
   }
 }
 
@@ -184,6 +347,16 @@ int main(int argc, char* argv[]) {
   int round_limit = 30;
   /* Set default turn limit. */
   int turn_limit = INT_MAX;
+  /* Set default listen backlog. */
+  int backlog = 1024;
+  /* Use one server thread per hardware thread by default. */
+  int threads = 0;
+  /* Simulate each problem once by default. */
+  long rollouts = 0;
+  /* Snapshot of grounded problems to load, if any. */
+  std::string load_snapshot;
+  /* Snapshot of grounded problems to save, if any. */
+  std::string save_snapshot;
 
   /*
    * Get command line options.
@@ -196,9 +369,18 @@ int main(int argc, char* argv[]) {
       break;
     }
     switch (c) {
+    case 'b':
+      backlog = atoi(optarg);
+      break;
     case 'C':
       config = optarg;
       break;
+    case 'g':
+      load_snapshot = optarg;
+      break;
+    case 'G':
+      save_snapshot = optarg;
+      break;
     case 'P':
       port = atoi(optarg);
       break;
@@ -211,15 +393,24 @@ int main(int argc, char* argv[]) {
     case 'p':
       log_paths = true;
       break;
+    case 'r':
+      rollouts = atol(optarg);
+      break;
     case 'R':
       round_limit = atoi(optarg);
       break;
     case 'S':
       seed = atoi(optarg);
       break;
+    case 't':
+      threads = atoi(optarg);
+      break;
     case 'T':
       time_limit = std::chrono::milliseconds(atol(optarg));
       break;
+    case 'u':
+      Problem::prune_unreachable = true;
+      break;
     case 'v':
       verbosity = (optarg != 0) ? atoi(optarg) : 1;
       break;
@@ -239,12 +430,14 @@ int main(int argc, char* argv[]) {
       return -1;
     }
   }
-  srand(seed);
 
   try {
     /*
      * Read pddl files.
      */
+    if (!load_snapshot.empty()) {
+      load_grounded(load_snapshot);
+    }
     if (optind < argc) {
       /*
        * Use remaining command line arguments as file names.
@@ -254,7 +447,7 @@ int main(int argc, char* argv[]) {
           return -1;
         }
       }
-    } else {
+    } else if (load_snapshot.empty()) {
       /*
        * No remaining command line argument, so read from standard input.
        */
@@ -286,7 +479,9 @@ int main(int argc, char* argv[]) {
       std::cerr << "----------------------------------------"<< std::endl;
     }
 
-    if (port == 0) {
+    if (!save_snapshot.empty()) {
+      save_grounded(save_snapshot);
+    } else if (port == 0) {
       for (Problem::ProblemMap::const_iterator pi = Problem::begin();
            pi != Problem::end(); pi++) {
         const Problem& problem = *(*pi).second;
@@ -294,31 +489,41 @@ int main(int argc, char* argv[]) {
           std::cerr << "simulating problem `" << problem.name() << "'"
                     << std::endl;
         }
-        const State* s = new State(problem);
+        if (rollouts > 0) {
+          run_rollouts(problem, rollouts, turn_limit, threads, seed);
+          continue;
+        }
+        Random random(seed);
+        State s(problem, random);
+        ActionList actions;
+        problem.enabled_actions(actions, s.atoms(), s.values());
+        AtomList changed_atoms;
+        FluentList changed_fluents;
         int time = 0;
-        while (time < turn_limit && !s->goal()) {
-          const Action* action =
-            action_selection(s->atoms(), s->values(), problem);
+        while (time < turn_limit && !s.goal()) {
+          const Action* action = action_selection(actions, random);
           if (action == 0) {
             break;
           }
-          std::cout << std::endl << time << ": " << *s << std::endl;
-          const State& next_s = s->next(*action);
-          delete s;
-          s = &next_s;
+          std::cout << std::endl << time << ": " << s << std::endl;
+          changed_atoms.clear();
+          changed_fluents.clear();
+          s.advance(*action, changed_atoms, changed_fluents, random);
+          problem.update_enabled_actions(actions,
+                                         changed_atoms, changed_fluents,
+                                         s.atoms(), s.values());
           time++;
         }
-        std::cout << std::endl << time << ": " << *s << std::endl;
-        if (s->goal()) {
+        std::cout << std::endl << time << ": " << s << std::endl;
+        if (s.goal()) {
           std::cout << "  goal achieved" << std::endl;
         } else if (time >= turn_limit) {
           std::cout << "  turn limit reached" << std::endl;
         }
         if (!problem.constant_metric()) {
           std::cout << "  value of maximization metric is "
-                    << problem.metric().value(s->values()) << std::endl;
+                    << problem.metric_value(s.values()) << std::endl;
         }
-        delete s;
       }
     } else {
       if (!config.empty()) {
@@ -342,7 +547,8 @@ int main(int argc, char* argv[]) {
           config_map[problem_name] = cfg;
         }
       }
-      return run_server(port, time_limit, round_limit, turn_limit);
+      return run_server(port, time_limit, round_limit, turn_limit,
+                        backlog, threads, seed);
     }
   } catch (const std::exception& e) {
     std::cerr << PACKAGE ": " << e.what() << std::endl;
@@ -33,7 +33,7 @@ extern int verbosity;
 /* The reward function. */
 static const Function* reward_function;
 /* The goal reward. */
-static Rational goal_reward;
+static Number goal_reward;
 /* State variables for the current problem. */
 static std::map<const Atom*, int> state_variables;
 /* A mapping from variable indices to atoms. */
@@ -501,7 +501,7 @@ static DdNode* effect_dbn(std::map<int, DdNode*>& cpts,
     ue->update().affect(values);
     DdNode* ddc = Cudd_BddToAdd(dd_man, condition_bdd);
     Cudd_Ref(ddc);
-    DdNode* ddr = Cudd_addConst(dd_man, values[&fluent].double_value());
+    DdNode* ddr = Cudd_addConst(dd_man, to_double(values[&fluent]));
     Cudd_Ref(ddr);
     DdNode* ddR = Cudd_addApply(dd_man, Cudd_addTimes, ddc, ddr);
     Cudd_Ref(ddR);
@@ -961,11 +961,7 @@ static DdNode* solve_problem(const Problem& problem,
   /*
    * Collect state variables and assign indices to them.
    */
-  const StateFormula& inst_goal =
-    problem.goal().instantiation(SubstitutionMap(), problem.terms(),
-                                 problem.init_atoms(), problem.init_values(),
-                                 false);
-  RCObject::ref(&inst_goal);
+  const StateFormula& inst_goal = problem.ground_goal();
   collect_state_variables(inst_goal);
   for (ActionSet::const_iterator ai = problem.actions().begin();
        ai != problem.actions().end(); ai++) {
@@ -1015,7 +1011,6 @@ static DdNode* solve_problem(const Problem& problem,
    * Construct a BDD representing goal states.
    */
   DdNode* ddg = formula_bdd(inst_goal);
-  RCObject::destructive_deref(&inst_goal);
   if (verbosity > 1) {
     std::cout << std::endl << "Goal state BDD:" << std::endl;
     Cudd_PrintDebug(dd_man, ddg, 2*nvars, 2);
@@ -1052,7 +1047,7 @@ static DdNode* solve_problem(const Problem& problem,
     DdNode* ddt = Cudd_BddToAdd(dd_man, ddgp);
     Cudd_Ref(ddt);
     Cudd_RecursiveDeref(dd_man, ddgp);
-    DdNode* ddr = Cudd_addConst(dd_man, goal_reward.double_value());
+    DdNode* ddr = Cudd_addConst(dd_man, to_double(goal_reward));
     Cudd_Ref(ddr);
     ddgr = Cudd_addApply(dd_man, Cudd_addTimes, ddt, ddr);
     Cudd_Ref(ddgr);
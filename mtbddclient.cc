@@ -18,6 +18,7 @@
 #include "mtbdd.h"
 #include "problems.h"
 #include "domains.h"
+#include "snapshots.h"
 #if HAVE_GETOPT_LONG
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -52,14 +53,16 @@ int verbosity;
 static struct option long_options[] = {
   { "tolerance", required_argument, 0, 'E' },
   { "discount-factor", required_argument, 0, 'G' },
+  { "load-grounded", required_argument, 0, 'g' },
   { "host", required_argument, 0, 'H' },
   { "port", required_argument, 0, 'P' },
+  { "prune-unreachable", no_argument, 0, 'u' },
   { "verbose", optional_argument, 0, 'v' },
   { "warnings", optional_argument, 0, 'W' },
   { "help", no_argument, 0, 'h' },
   { 0, 0, 0, 0 }
 };
-static const char OPTION_STRING[] = "E:G:H:P:v::W::h";
+static const char OPTION_STRING[] = "E:G:g:H:P:uv::W::h";
 
 
 /* Displays help. */
@@ -70,10 +73,17 @@ static void display_help() {
             << "use error tolerance e (default is 0.1)" << std::endl
             << "  -G g,  --discount-factor=g" << std::endl
             << "\t\t\tuse discount factor g (default is 0.9)" << std::endl
+            << "  -g f,  --load-grounded=f" << std::endl
+            << "\t\t\tload grounded problems from snapshot f" << std::endl
             << "  -H h,  --host=h\t"
             << "connect to host h" << std::endl
             << "  -P p,  --port=p\t"
             << "connect to port p" << std::endl
+            << "  -u,    --prune-unreachable" << std::endl
+            << "\t\t\tdrop actions that are unreachable from the initial"
+            << std::endl
+            << "\t\t\t  state even when delete effects are ignored"
+            << std::endl
             << "  -v[n], --verbose[=n]\t"
             << "use verbosity level n;" << std::endl
             << "\t\t\t  n is a number from 0 (verbose mode off) and up;"
@@ -155,6 +165,8 @@ int main(int argc, char* argv[]) {
   std::string host;
   /* Port. */
   int port = 0;
+  /* Snapshot of grounded problems to load, if any. */
+  std::string snapshot;
 
   try {
     /*
@@ -183,12 +195,18 @@ int main(int argc, char* argv[]) {
           throw std::invalid_argument("discount factor must be less than 1");
         }
         break;
+      case 'g':
+        snapshot = optarg;
+        break;
       case 'H':
         host = optarg;
         break;
       case 'P':
         port = atoi(optarg);
         break;
+      case 'u':
+        Problem::prune_unreachable = true;
+        break;
       case 'v':
         verbosity = (optarg != 0) ? atoi(optarg) : 1;
         break;
@@ -209,6 +227,9 @@ int main(int argc, char* argv[]) {
     /*
      * Read pddl files.
      */
+    if (!snapshot.empty()) {
+      load_grounded(snapshot);
+    }
     if (optind < argc) {
       /*
        * Use remaining command line arguments as file names.
@@ -218,7 +239,7 @@ int main(int argc, char* argv[]) {
           return -1;
         }
       }
-    } else {
+    } else if (snapshot.empty()) {
       /*
        * No remaining command line argument, so read from standard input.
        */
@@ -263,7 +284,7 @@ int main(int argc, char* argv[]) {
       const Problem& problem = *(*pi).second;
       MTBDDPlanner planner(problem, gamma, epsilon);
       if (port > 0) {
-        XMLClient(planner, problem, "mtbddclient", socket);
+        XMLClient(planner, problem, "mtbddclient", socket, false);
       } else {
         planner.initRound();
       }
@@ -20,6 +20,7 @@
 
 #include <config.h>
 #include "types.h"
+#include <functional>
 #include <iostream>
 #include <map>
 #include <set>
@@ -45,6 +46,7 @@ struct Predicate {
   friend bool operator<(const Predicate& p1, const Predicate& p2);
   friend std::ostream& operator<<(std::ostream& os, const Predicate& p);
   friend struct PredicateTable;
+  friend struct std::hash<Predicate>;
 };
 
 /* Equality operator for predicates. */
@@ -65,6 +67,17 @@ inline bool operator<(const Predicate& p1, const Predicate& p2) {
 /* Output operator for predicates. */
 std::ostream& operator<<(std::ostream& os, const Predicate& p);
 
+/*
+ * Hash function object for predicates.
+ */
+namespace std {
+template<>
+struct hash<Predicate> {
+  /* Hash function operator. */
+  size_t operator()(const Predicate& p) const { return p.index_; }
+};
+}
+
 
 /* ====================================================================== */
 /* PredicateSet */
@@ -104,6 +117,11 @@ struct PredicateTable {
      no predicate with the given name exists. */
   const Predicate* find_predicate(const std::string& name) const;
 
+  /* Returns the predicates of this table, keyed by name. */
+  const std::map<std::string, Predicate>& predicates() const {
+    return predicates_;
+  }
+
  private:
   /* Predicate names. */
   static std::vector<std::string> names_;
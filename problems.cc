@@ -16,12 +16,355 @@
  */
 #include "problems.h"
 #include "domains.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <thread>
 #include <typeinfo>
 
 
 /* ====================================================================== */
 /* Problem */
 
+/* Whether instantiate() drops unreachable actions. */
+bool Problem::prune_unreachable = false;
+
+
+/* Assigns indices to all ground atoms that the given effect can add
+   or delete, and to all ground fluents that it can update. */
+static void index_effect(const Effect& effect) {
+  const SimpleEffect* se = dynamic_cast<const SimpleEffect*>(&effect);
+  if (se != 0) {
+    se->atom().index();
+    return;
+  }
+  const UpdateEffect* ue = dynamic_cast<const UpdateEffect*>(&effect);
+  if (ue != 0) {
+    ue->update().fluent().index();
+    return;
+  }
+  const ConjunctiveEffect* ce =
+    dynamic_cast<const ConjunctiveEffect*>(&effect);
+  if (ce != 0) {
+    for (EffectList::const_iterator ei = ce->conjuncts().begin();
+         ei != ce->conjuncts().end(); ei++) {
+      index_effect(**ei);
+    }
+    return;
+  }
+  const ConditionalEffect* we =
+    dynamic_cast<const ConditionalEffect*>(&effect);
+  if (we != 0) {
+    index_effect(we->effect());
+    return;
+  }
+  const ProbabilisticEffect* pe =
+    dynamic_cast<const ProbabilisticEffect*>(&effect);
+  if (pe != 0) {
+    for (size_t i = 0; i < pe->size(); i++) {
+      index_effect(pe->effect(i));
+    }
+    return;
+  }
+  /* Quantified effects in the initial conditions are not ground, so
+     their atoms and fluents are indexed when first inserted into a
+     state. */
+}
+
+
+/* Compiles the conditions and update expressions in the given effect,
+   except in quantified effects, which are not ground. */
+static void compile_effect(const Effect& effect) {
+  const UpdateEffect* ue = dynamic_cast<const UpdateEffect*>(&effect);
+  if (ue != 0) {
+    const_cast<Update&>(ue->update()).compile();
+    return;
+  }
+  const ConjunctiveEffect* ce =
+    dynamic_cast<const ConjunctiveEffect*>(&effect);
+  if (ce != 0) {
+    for (EffectList::const_iterator ei = ce->conjuncts().begin();
+         ei != ce->conjuncts().end(); ei++) {
+      compile_effect(**ei);
+    }
+    return;
+  }
+  const ConditionalEffect* we =
+    dynamic_cast<const ConditionalEffect*>(&effect);
+  if (we != 0) {
+    const_cast<ConditionalEffect&>(*we).compile();
+    compile_effect(we->effect());
+    return;
+  }
+  const ProbabilisticEffect* pe =
+    dynamic_cast<const ProbabilisticEffect*>(&effect);
+  if (pe != 0) {
+    for (size_t i = 0; i < pe->size(); i++) {
+      compile_effect(pe->effect(i));
+    }
+  }
+}
+
+
+/* Tests if the given ground state formula can hold in a state where
+   only the given atoms can be true, ignoring delete effects.  Negated
+   formulas, comparisons, and quantified formulas are assumed to be
+   able to hold. */
+static bool relaxed_holds(const StateFormula& formula,
+                          const std::set<const Atom*>& atoms) {
+  if (formula.tautology()) {
+    return true;
+  } else if (formula.contradiction()) {
+    return false;
+  }
+  const Atom* atom = dynamic_cast<const Atom*>(&formula);
+  if (atom != 0) {
+    return atoms.find(atom) != atoms.end();
+  }
+  const Conjunction* conj = dynamic_cast<const Conjunction*>(&formula);
+  if (conj != 0) {
+    for (FormulaList::const_iterator fi = conj->conjuncts().begin();
+         fi != conj->conjuncts().end(); fi++) {
+      if (!relaxed_holds(**fi, atoms)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  const Disjunction* disj = dynamic_cast<const Disjunction*>(&formula);
+  if (disj != 0) {
+    for (FormulaList::const_iterator fi = disj->disjuncts().begin();
+         fi != disj->disjuncts().end(); fi++) {
+      if (relaxed_holds(**fi, atoms)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+
+/* Adds the atoms that the given ground effect can add to the given
+   set, counting every outcome of probabilistic effects and every
+   conditional effect whose condition can hold.  Returns false if the
+   added atoms cannot be determined. */
+static bool relaxed_adds(const Effect& effect, std::set<const Atom*>& atoms) {
+  const AddEffect* ae = dynamic_cast<const AddEffect*>(&effect);
+  if (ae != 0) {
+    atoms.insert(&ae->atom());
+    return true;
+  }
+  if (dynamic_cast<const DeleteEffect*>(&effect) != 0
+      || dynamic_cast<const UpdateEffect*>(&effect) != 0) {
+    return true;
+  }
+  const ConjunctiveEffect* ce =
+    dynamic_cast<const ConjunctiveEffect*>(&effect);
+  if (ce != 0) {
+    for (EffectList::const_iterator ei = ce->conjuncts().begin();
+         ei != ce->conjuncts().end(); ei++) {
+      if (!relaxed_adds(**ei, atoms)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  const ConditionalEffect* we =
+    dynamic_cast<const ConditionalEffect*>(&effect);
+  if (we != 0) {
+    return (!relaxed_holds(we->condition(), atoms)
+            || relaxed_adds(we->effect(), atoms));
+  }
+  const ProbabilisticEffect* pe =
+    dynamic_cast<const ProbabilisticEffect*>(&effect);
+  if (pe != 0) {
+    for (size_t i = 0; i < pe->size(); i++) {
+      if (!relaxed_adds(pe->effect(i), atoms)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+
+/* Returns a positive atom that must hold for the given precondition
+   to hold, or 0 if there is no such atom.  Among several candidates,
+   the atom with the fewest actions keyed on it so far is chosen. */
+static const Atom* key_atom(const StateFormula& precondition,
+                            const std::vector<ActionList>& keyed_actions) {
+  const Atom* atom = dynamic_cast<const Atom*>(&precondition);
+  if (atom != 0) {
+    return atom;
+  }
+  const Conjunction* conj = dynamic_cast<const Conjunction*>(&precondition);
+  if (conj == 0) {
+    return 0;
+  }
+  const Atom* key = 0;
+  size_t key_size = 0;
+  for (FormulaList::const_iterator fi = conj->conjuncts().begin();
+       fi != conj->conjuncts().end(); fi++) {
+    const Atom* atom = dynamic_cast<const Atom*>(*fi);
+    if (atom != 0) {
+      size_t size = (atom->index() < keyed_actions.size()
+                     ? keyed_actions[atom->index()].size() : 0);
+      if (key == 0 || size < key_size) {
+        key = atom;
+        key_size = size;
+      }
+    }
+  }
+  return key;
+}
+
+
+/* Fills the provided list with the fluents that the given expression
+   mentions.  Returns false if the fluents cannot be determined. */
+static bool fluent_dependencies(const Expression& expr, FluentList& fluents) {
+  if (dynamic_cast<const Value*>(&expr) != 0) {
+    return true;
+  }
+  const Fluent* fluent = dynamic_cast<const Fluent*>(&expr);
+  if (fluent != 0) {
+    fluents.push_back(fluent);
+    return true;
+  }
+  const Computation* comp = dynamic_cast<const Computation*>(&expr);
+  if (comp != 0) {
+    return (fluent_dependencies(comp->operand1(), fluents)
+            && fluent_dependencies(comp->operand2(), fluents));
+  }
+  return false;
+}
+
+
+/* Fills the provided lists with the atoms and fluents that the given
+   ground state formula mentions.  Returns false if the atoms and
+   fluents cannot be determined. */
+static bool dependencies(const StateFormula& formula,
+                         AtomList& atoms, FluentList& fluents) {
+  if (formula.tautology() || formula.contradiction()
+      || dynamic_cast<const Equality*>(&formula) != 0) {
+    return true;
+  }
+  const Atom* atom = dynamic_cast<const Atom*>(&formula);
+  if (atom != 0) {
+    atoms.push_back(atom);
+    return true;
+  }
+  const Comparison* comp = dynamic_cast<const Comparison*>(&formula);
+  if (comp != 0) {
+    return (fluent_dependencies(comp->expr1(), fluents)
+            && fluent_dependencies(comp->expr2(), fluents));
+  }
+  const Negation* neg = dynamic_cast<const Negation*>(&formula);
+  if (neg != 0) {
+    return dependencies(neg->negand(), atoms, fluents);
+  }
+  const Conjunction* conj = dynamic_cast<const Conjunction*>(&formula);
+  if (conj != 0) {
+    for (FormulaList::const_iterator fi = conj->conjuncts().begin();
+         fi != conj->conjuncts().end(); fi++) {
+      if (!dependencies(**fi, atoms, fluents)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  const Disjunction* disj = dynamic_cast<const Disjunction*>(&formula);
+  if (disj != 0) {
+    for (FormulaList::const_iterator fi = disj->disjuncts().begin();
+         fi != disj->disjuncts().end(); fi++) {
+      if (!dependencies(**fi, atoms, fluents)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+
+/* Adds the given action to the list with the given index, growing the
+   table of lists as needed. */
+static void add_dependent(std::vector<ActionList>& dependents, size_t index,
+                          const Action& action) {
+  if (index >= dependents.size()) {
+    dependents.resize(index + 1);
+  }
+  ActionList& actions = dependents[index];
+  if (actions.empty() || actions.back() != &action) {
+    actions.push_back(&action);
+  }
+}
+
+
+/* Returns the XML for the given atom in a state of the given
+   problem, or an empty string if the atom is left out of states. */
+static std::string atom_xml(const Problem& problem, const Atom& atom) {
+  if (!problem.observable(atom)) {
+    return std::string();
+  }
+  std::ostringstream os;
+  os << "<atom><predicate>" << atom.predicate() << "</predicate>";
+  for (TermList::const_iterator ti = atom.terms().begin();
+       ti != atom.terms().end(); ti++) {
+    os << "<term>" << *ti << "</term>";
+  }
+  os << "</atom>";
+  return os.str();
+}
+
+
+/* Returns the XML for the given fluent in a state of the given
+   problem, up to and including the start tag of its value, or an
+   empty string if the fluent is left out of states. */
+static std::string fluent_xml(const Problem& problem, const Fluent& fluent) {
+  if (!problem.observable(fluent)) {
+    return std::string();
+  }
+  std::ostringstream os;
+  os << "<fluent><function>" << fluent.function() << "</function>";
+  for (TermList::const_iterator ti = fluent.terms().begin();
+       ti != fluent.terms().end(); ti++) {
+    os << "<term>" << *ti << "</term>";
+  }
+  os << "<value>";
+  return os.str();
+}
+
+
+/* Appends the given fluent value to the given string.  Doubles are
+   written in the shortest form that reads back as the same double. */
+static void append_number(std::string& s, const Number& x) {
+  char buffer[32];
+#ifdef DOUBLE_VALUES
+  char* last = std::to_chars(buffer, buffer + sizeof buffer, x).ptr;
+#else
+  char* last = std::to_chars(buffer, buffer + sizeof buffer,
+                             x.numerator()).ptr;
+  if (x.denominator() != 1) {
+    *last++ = '/';
+    last = std::to_chars(last, buffer + sizeof buffer, x.denominator()).ptr;
+  }
+#endif
+  s.append(buffer, last);
+}
+
+
+/* Less-than comparison of actions by index. */
+static bool action_index_less(const Action* a1, const Action* a2) {
+  return a1->index() < a2->index();
+}
+
+
 /* Table of defined problems. */
 Problem::ProblemMap Problem::problems = Problem::ProblemMap();
 
@@ -60,9 +403,14 @@ void Problem::clear() {
 /* Constructs a problem. */
 Problem::Problem(const std::string& name, const Domain& domain)
   : name_(name), domain_(&domain), terms_(TermTable(domain.terms())),
-    goal_(&StateFormula::FALSE), goal_reward_(0), metric_(new Value(0)) {
+    goal_(&StateFormula::FALSE), ground_goal_(0), goal_reward_(0),
+    metric_(new Value(0)),
+    total_time_(&Fluent::make(domain.total_time(), TermList())),
+    goal_achieved_(&Fluent::make(domain.goal_achieved(), TermList())) {
   RCObject::ref(goal_);
   RCObject::ref(metric_);
+  RCObject::ref(total_time_);
+  RCObject::ref(goal_achieved_);
   const Problem* p = find(name);
   if (p != 0) {
     delete p;
@@ -87,10 +435,13 @@ Problem::~Problem() {
     RCObject::destructive_deref(*ei);
   }
   RCObject::destructive_deref(goal_);
+  RCObject::destructive_deref(ground_goal_);
   if (goal_reward_ != 0) {
     delete goal_reward_;
   }
   RCObject::destructive_deref(metric_);
+  RCObject::destructive_deref(total_time_);
+  RCObject::destructive_deref(goal_achieved_);
   for (ActionSet::const_iterator ai = actions_.begin();
        ai != actions_.end(); ai++) {
     delete *ai;
@@ -109,7 +460,7 @@ void Problem::add_init_atom(const Atom& atom) {
 
 
 /* Adds a fluent value to the initial conditions of this problem. */
-void Problem::add_init_value(const Fluent& fluent, const Rational& value) {
+void Problem::add_init_value(const Fluent& fluent, const Number& value) {
   if (init_values_.find(&fluent) == init_values_.end()) {
     init_values_.insert(std::make_pair(&fluent, value));
     RCObject::ref(&fluent);
@@ -132,6 +483,9 @@ void Problem::set_goal(const StateFormula& goal) {
     RCObject::ref(&goal);
     RCObject::destructive_deref(goal_);
     goal_ = &goal;
+    RCObject::destructive_deref(ground_goal_);
+    ground_goal_ = 0;
+    goal_program_ = FormulaProgram();
   }
 }
 
@@ -157,6 +511,7 @@ void Problem::set_metric(const Expression& metric, bool negate) {
     RCObject::ref(real_metric);
     RCObject::destructive_deref(metric_);
     metric_ = real_metric;
+    metric_program_ = ExpressionProgram();
   }
 }
 
@@ -172,14 +527,271 @@ void Problem::instantiate() {
                                                  init_values()));
   }
   set_metric(metric().instantiation(SubstitutionMap(), init_values()));
-  for (ActionSchemaMap::const_iterator ai = domain().actions().begin();
-       ai != domain().actions().end(); ai++) {
-    (*ai).second->instantiations(actions_, terms(),
-                                 init_atoms(), init_values());
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (num_threads == 1) {
+    for (ActionSchemaMap::const_iterator ai = domain().actions().begin();
+         ai != domain().actions().end(); ai++) {
+      (*ai).second->instantiations(actions_, terms(),
+                                   init_atoms(), init_values());
+    }
+  } else {
+    /* Split every action schema into one part per thread, and let the
+       threads take parts in turn.  Each thread collects its actions in
+       a set of its own, and the sets are merged once all threads are
+       done.  Atoms and fluents made while grounding are pinned so that
+       threads sharing them cannot delete them. */
+    std::vector<const ActionSchema*> schemas;
+    for (ActionSchemaMap::const_iterator ai = domain().actions().begin();
+         ai != domain().actions().end(); ai++) {
+      schemas.push_back((*ai).second);
+    }
+    size_t num_tasks = schemas.size()*num_threads;
+    std::atomic<size_t> next_task(0);
+    std::vector<ActionSet> actions(num_threads);
+    std::vector<std::exception_ptr> errors(num_threads);
+    Atom::pin_all();
+    Fluent::pin_all();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+      threads.push_back(std::thread([&, t]() {
+        try {
+          for (size_t i = next_task++; i < num_tasks; i = next_task++) {
+            schemas[i/num_threads]->instantiations(actions[t], terms(),
+                                                   init_atoms(),
+                                                   init_values(),
+                                                   i%num_threads,
+                                                   num_threads);
+          }
+        } catch (...) {
+          errors[t] = std::current_exception();
+          next_task = num_tasks;
+        }
+      }));
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+      threads[t].join();
+      actions_.insert(actions[t].begin(), actions[t].end());
+    }
+    Fluent::unpin_all();
+    Atom::unpin_all();
+    for (size_t t = 0; t < num_threads; t++) {
+      if (errors[t]) {
+        std::rethrow_exception(errors[t]);
+      }
+    }
+  }
+  if (prune_unreachable) {
+    prune_unreachable_actions();
+  }
+  finish_instantiation();
+}
+
+
+/* Adds an instantiated action to this problem. */
+void Problem::add_action(const Action& action) {
+  actions_.insert(&action);
+}
+
+
+/* Prepares this problem for simulation once its actions have been
+   instantiated or added. */
+void Problem::finish_instantiation() {
+  /* Index every atom that can become true or false and every fluent
+     that can change value in a state up front, so that simulating the
+     problem never assigns new indices. */
+  total_time().index();
+  goal_achieved().index();
+  if (goal_reward() != 0) {
+    goal_reward()->fluent().index();
+  }
+  for (EffectList::const_iterator ei = init_effects().begin();
+       ei != init_effects().end(); ei++) {
+    index_effect(**ei);
+  }
+  for (ActionSet::const_iterator ai = actions().begin();
+       ai != actions().end(); ai++) {
+    index_effect((*ai)->effect());
+  }
+  /* Compile action preconditions, effect conditions, update
+     expressions, the goal, and the metric after the effects have been
+     indexed, so that atoms and fluents that are only read get the
+     indices that follow.  Quantifiers in action preconditions are
+     expanded when the actions are instantiated, but the goal is
+     expanded here, once, rather than on every test. */
+  for (ActionSet::const_iterator ai = actions().begin();
+       ai != actions().end(); ai++) {
+    const_cast<Action&>(**ai).compile();
+    compile_effect((*ai)->effect());
+  }
+  for (EffectList::const_iterator ei = init_effects().begin();
+       ei != init_effects().end(); ei++) {
+    compile_effect(**ei);
+  }
+  if (goal_reward() != 0) {
+    const_cast<Update*>(goal_reward())->compile();
+  }
+  metric_program_ = ExpressionProgram(metric());
+  const StateFormula& ground_goal =
+    goal().instantiation(SubstitutionMap(), terms(),
+                         init_atoms(), init_values(), false);
+  RCObject::ref(&ground_goal);
+  RCObject::destructive_deref(ground_goal_);
+  ground_goal_ = &ground_goal;
+  goal_program_ = FormulaProgram(ground_goal);
+  index_actions();
+  build_xml();
+}
+
+
+/* Drops the instantiated actions that cannot become enabled when
+   delete effects are ignored.  The atoms that can become true are
+   computed as a fixpoint starting from the initial conditions, with
+   every outcome of a probabilistic effect counted as possible.  Atoms
+   that only the dropped actions mention are never indexed.  Nothing is
+   dropped if some effect adds atoms that cannot be determined. */
+void Problem::prune_unreachable_actions() {
+  std::set<const Atom*> atoms;
+  for (AtomSet::const_iterator ai = init_atoms().begin();
+       ai != init_atoms().end(); ai++) {
+    atoms.insert(*ai);
+  }
+  for (EffectList::const_iterator ei = init_effects().begin();
+       ei != init_effects().end(); ei++) {
+    if (!relaxed_adds(**ei, atoms)) {
+      return;
+    }
+  }
+  std::set<const Action*> enabled;
+  size_t num_atoms;
+  do {
+    num_atoms = atoms.size();
+    for (ActionSet::const_iterator ai = actions_.begin();
+         ai != actions_.end(); ai++) {
+      if (relaxed_holds((*ai)->precondition(), atoms)) {
+        enabled.insert(*ai);
+        if (!relaxed_adds((*ai)->effect(), atoms)) {
+          return;
+        }
+      }
+    }
+  } while (atoms.size() != num_atoms);
+  for (ActionSet::const_iterator ai = actions_.begin();
+       ai != actions_.end(); ) {
+    if (enabled.find(*ai) == enabled.end()) {
+      const Action* action = *ai;
+      actions_.erase(ai++);
+      delete action;
+    } else {
+      ai++;
+    }
+  }
+}
+
+
+/* Indexes the instantiated actions by their preconditions. */
+void Problem::index_actions() {
+  keyed_actions_.clear();
+  unkeyed_actions_.clear();
+  atom_dependents_.clear();
+  fluent_dependents_.clear();
+  volatile_actions_.clear();
+  indexed_actions_.clear();
+  for (ActionSet::const_iterator ai = actions_.begin();
+       ai != actions_.end(); ai++) {
+    Action& action = const_cast<Action&>(**ai);
+    action.set_index(indexed_actions_.size());
+    indexed_actions_.push_back(&action);
+    const Atom* key = key_atom(action.precondition(), keyed_actions_);
+    if (key != 0) {
+      if (key->index() >= keyed_actions_.size()) {
+        keyed_actions_.resize(key->index() + 1);
+      }
+      keyed_actions_[key->index()].push_back(&action);
+    } else {
+      unkeyed_actions_.push_back(&action);
+    }
+    AtomList atoms;
+    FluentList fluents;
+    if (dependencies(action.precondition(), atoms, fluents)) {
+      for (AtomList::const_iterator ai = atoms.begin();
+           ai != atoms.end(); ai++) {
+        add_dependent(atom_dependents_, (*ai)->index(), action);
+      }
+      for (FluentList::const_iterator fi = fluents.begin();
+           fi != fluents.end(); fi++) {
+        add_dependent(fluent_dependents_, (*fi)->index(), action);
+      }
+    } else {
+      volatile_actions_.push_back(&action);
+    }
   }
 }
 
 
+/* Builds the XML for the indexed atoms and fluents. */
+void Problem::build_xml() {
+  atom_xml_.resize(Atom::num_indexed());
+  for (size_t i = 0; i < atom_xml_.size(); i++) {
+    const Atom* atom = Atom::indexed_atom(i);
+    if (atom != 0) {
+      atom_xml_[i] = atom_xml(*this, *atom);
+    }
+  }
+  fluent_xml_.resize(Fluent::num_indexed());
+  for (size_t i = 0; i < fluent_xml_.size(); i++) {
+    const Fluent* fluent = Fluent::indexed_fluent(i);
+    if (fluent != 0) {
+      fluent_xml_[i] = fluent_xml(*this, *fluent);
+    }
+  }
+}
+
+
+/* Appends the XML for the given atom in a state of this problem to the
+   given string. */
+void Problem::append_xml(std::string& xml, const Atom& atom) const {
+  if (atom.index() < atom_xml_.size()) {
+    xml += atom_xml_[atom.index()];
+  } else {
+    xml += atom_xml(*this, atom);
+  }
+}
+
+
+/* Appends the XML for the given fluent value in a state of this problem
+   to the given string. */
+void Problem::append_xml(std::string& xml,
+                         const Fluent& fluent, const Number& value) const {
+  size_t size = xml.size();
+  if (fluent.index() < fluent_xml_.size()) {
+    xml += fluent_xml_[fluent.index()];
+  } else {
+    xml += fluent_xml(*this, fluent);
+  }
+  if (xml.size() > size) {
+    append_number(xml, value);
+    xml += "</value></fluent>";
+  }
+}
+
+
+/* Tests if the given atom is included in states sent to clients.
+   Atoms of static predicates are left out of states. */
+bool Problem::observable(const Atom& atom) const {
+  return !PredicateTable::static_predicate(atom.predicate());
+}
+
+
+/* Tests if the given fluent is included in states sent to clients.
+   Static fluents and the fluents maintained by the simulator are left
+   out of states. */
+bool Problem::observable(const Fluent& fluent) const {
+  return (fluent.function() != domain().total_time()
+          && fluent.function() != domain().goal_achieved()
+          && !FunctionTable::static_function(fluent.function()));
+}
+
+
 /* Tests if the metric is constant. */
 bool Problem::constant_metric() const {
   return typeid(metric()) == typeid(Value);
@@ -189,12 +801,101 @@ bool Problem::constant_metric() const {
 /* Fills the given list with actions enabled in the given state. */
 void Problem::enabled_actions(ActionList& actions, const AtomSet& atoms,
                               const ValueMap& values) const {
-  for (ActionSet::const_iterator ai = this->actions().begin();
-       ai != this->actions().end(); ai++) {
-    if ((*ai)->enabled(terms(), atoms, values)) {
-      actions.push_back(*ai);
+  /* Only actions whose key atom holds, and actions without a key
+     atom, can be enabled. */
+  size_t first = actions.size();
+  for (AtomSet::const_iterator ai = atoms.begin(); ai != atoms.end(); ai++) {
+    size_t index = (*ai)->index();
+    if (index < keyed_actions_.size()) {
+      const ActionList& candidates = keyed_actions_[index];
+      for (ActionList::const_iterator ci = candidates.begin();
+           ci != candidates.end(); ci++) {
+        if ((*ci)->enabled(terms(), atoms, values)) {
+          actions.push_back(*ci);
+        }
+      }
+    }
+  }
+  for (ActionList::const_iterator ci = unkeyed_actions_.begin();
+       ci != unkeyed_actions_.end(); ci++) {
+    if ((*ci)->enabled(terms(), atoms, values)) {
+      actions.push_back(*ci);
+    }
+  }
+  std::sort(actions.begin() + first, actions.end(), action_index_less);
+}
+
+
+/* Updates the given list of actions enabled in a state to the actions
+   enabled in a successor state, given the atoms and fluents that
+   differ between the two states. */
+void Problem::update_enabled_actions(ActionList& actions,
+                                     const AtomList& changed_atoms,
+                                     const FluentList& changed_fluents,
+                                     const AtomSet& atoms,
+                                     const ValueMap& values) const {
+  /* Scratch lists, kept per thread so that their storage is reused
+     from one transition to the next. */
+  static thread_local ActionList candidates;
+  static thread_local ActionList disabled;
+  static thread_local ActionList enabled;
+  static thread_local ActionList merged;
+  candidates.assign(volatile_actions_.begin(), volatile_actions_.end());
+  for (AtomList::const_iterator ai = changed_atoms.begin();
+       ai != changed_atoms.end(); ai++) {
+    if ((*ai)->indexed() && (*ai)->index() < atom_dependents_.size()) {
+      const ActionList& dependents = atom_dependents_[(*ai)->index()];
+      candidates.insert(candidates.end(),
+                        dependents.begin(), dependents.end());
+    }
+  }
+  for (FluentList::const_iterator fi = changed_fluents.begin();
+       fi != changed_fluents.end(); fi++) {
+    if ((*fi)->indexed() && (*fi)->index() < fluent_dependents_.size()) {
+      const ActionList& dependents = fluent_dependents_[(*fi)->index()];
+      candidates.insert(candidates.end(),
+                        dependents.begin(), dependents.end());
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
+  std::sort(candidates.begin(), candidates.end(), action_index_less);
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+  /* Partition the candidates into actions that became disabled and
+     actions that became enabled. */
+  disabled.clear();
+  enabled.clear();
+  for (ActionList::const_iterator ci = candidates.begin();
+       ci != candidates.end(); ci++) {
+    bool was_enabled = std::binary_search(actions.begin(), actions.end(),
+                                          *ci, action_index_less);
+    if ((*ci)->enabled(terms(), atoms, values)) {
+      if (!was_enabled) {
+        enabled.push_back(*ci);
+      }
+    } else if (was_enabled) {
+      disabled.push_back(*ci);
     }
   }
+  if (!disabled.empty()) {
+    ActionList::iterator last = actions.begin();
+    for (ActionList::const_iterator ai = actions.begin();
+         ai != actions.end(); ai++) {
+      if (!std::binary_search(disabled.begin(), disabled.end(),
+                              *ai, action_index_less)) {
+        *last++ = *ai;
+      }
+    }
+    actions.erase(last, actions.end());
+  }
+  if (!enabled.empty()) {
+    merged.clear();
+    std::merge(actions.begin(), actions.end(), enabled.begin(), enabled.end(),
+               std::back_inserter(merged), action_index_less);
+    actions.swap(merged);
+  }
 }
 
 
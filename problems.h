@@ -26,11 +26,13 @@
 #include "effects.h"
 #include "formulas.h"
 #include "expressions.h"
+#include "programs.h"
 #include "terms.h"
 #include "types.h"
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 
 /* ====================================================================== */
@@ -57,6 +59,11 @@ struct Problem {
   /* Removes all defined problems. */
   static void clear();
 
+  /* Whether instantiate() drops the actions that cannot become
+     enabled in any state reachable from the initial conditions when
+     delete effects are ignored. */
+  static bool prune_unreachable;
+
   /* Constructs a problem. */
   Problem(const std::string& name, const Domain& domain);
 
@@ -80,7 +87,14 @@ struct Problem {
   void add_init_atom(const Atom& atom);
 
   /* Adds a fluent value to the initial conditions of this problem. */
-  void add_init_value(const Fluent& fluent, const Rational& value);
+  void add_init_value(const Fluent& fluent, const Number& value);
+
+#ifdef DOUBLE_VALUES
+  /* Adds a fluent value to the initial conditions of this problem. */
+  void add_init_value(const Fluent& fluent, const Rational& value) {
+    add_init_value(fluent, to_number(value));
+  }
+#endif
 
   /* Adds an initial effect for this problem. */
   void add_init_effect(const Effect& effect);
@@ -97,6 +111,14 @@ struct Problem {
   /* Instantiates this problem. */
   void instantiate();
 
+  /* Adds an instantiated action to this problem. */
+  void add_action(const Action& action);
+
+  /* Prepares this problem for simulation once its actions have been
+     instantiated or added, by indexing its atoms, fluents, and
+     actions. */
+  void finish_instantiation();
+
   /* Returns the initial atoms of this problem. */
   const AtomSet& init_atoms() const { return init_atoms_; }
 
@@ -109,6 +131,23 @@ struct Problem {
   /* Returns the goal of this problem. */
   const StateFormula& goal() const { return *goal_; }
 
+  /* Returns the goal of this problem with its quantifiers expanded
+     over the objects of the problem and its static parts folded away.
+     Returns the goal itself if the problem has not been
+     instantiated. */
+  const StateFormula& ground_goal() const {
+    return (ground_goal_ != 0) ? *ground_goal_ : goal();
+  }
+
+  /* Tests if the goal of this problem holds in the given state. */
+  bool goal_holds(const AtomSet& atoms, const ValueMap& values) const {
+    if (goal_program_.compiled()) {
+      return goal_program_.holds(terms(), atoms, values);
+    } else {
+      return goal().holds(terms(), atoms, values);
+    }
+  }
+
   /* Returns a pointer to the goal reward for this problem, or 0 if no
      explicit reward is associated with goal states. */
   const Update* goal_reward() const { return goal_reward_; }
@@ -116,16 +155,64 @@ struct Problem {
   /* Returns the metric to maximize for this problem. */
   const Expression& metric() const { return *metric_; }
 
+  /* Returns the value of the metric in the given state. */
+  Number metric_value(const ValueMap& values) const {
+    if (metric_program_.compiled()) {
+      return metric_program_.value(values);
+    } else {
+      return metric().value(values);
+    }
+  }
+
+  /* Returns the ground fluent counting the time steps taken. */
+  const Fluent& total_time() const { return *total_time_; }
+
+  /* Returns the ground fluent set when the goal has been achieved. */
+  const Fluent& goal_achieved() const { return *goal_achieved_; }
+
   /* Tests if the metric is constant. */
   bool constant_metric() const;
 
   /* Returns a list of instantiated actions. */
   const ActionSet& actions() const { return actions_; }
 
-  /* Fills the given list with actions enabled in the given state. */
+  /* Returns the instantiated action with the given index, or 0 if no
+     such action exists. */
+  const Action* indexed_action(size_t index) const {
+    return (index < indexed_actions_.size()) ? indexed_actions_[index] : 0;
+  }
+
+  /* Tests if the given atom is included in states sent to clients. */
+  bool observable(const Atom& atom) const;
+
+  /* Tests if the given fluent is included in states sent to
+     clients. */
+  bool observable(const Fluent& fluent) const;
+
+  /* Appends the XML for the given atom in a state of this problem to
+     the given string. */
+  void append_xml(std::string& xml, const Atom& atom) const;
+
+  /* Appends the XML for the given fluent value in a state of this
+     problem to the given string. */
+  void append_xml(std::string& xml,
+                  const Fluent& fluent, const Number& value) const;
+
+  /* Fills the given list with actions enabled in the given state.
+     The actions are listed in the same order as in actions(). */
   void enabled_actions(ActionList& actions, const AtomSet& atoms,
                        const ValueMap& values) const;
 
+  /* Updates the given list of actions enabled in a state to the
+     actions enabled in a successor state, given the atoms and fluents
+     that differ between the two states.  Only actions whose
+     preconditions mention a changed atom or fluent are reevaluated. */
+  void update_enabled_actions(ActionList& actions,
+                              const AtomList& changed_atoms,
+                              const FluentList& changed_fluents,
+                              const AtomSet& atoms,
+                              const ValueMap& values) const;
+
  private:
   /* Table of defined problems. */
   static ProblemMap problems;
@@ -144,12 +231,52 @@ struct Problem {
   EffectList init_effects_;
   /* Goal; FALSE if not a goal-directed planning problem. */
   const StateFormula* goal_;
+  /* Ground goal, or 0 if the problem has not been instantiated. */
+  const StateFormula* ground_goal_;
+  /* Compiled ground goal, if compiled. */
+  FormulaProgram goal_program_;
   /* Goal reward expression. */
   const Update* goal_reward_;
   /* Metric to maximize. */
   const Expression* metric_;
+  /* Compiled metric, if compiled. */
+  ExpressionProgram metric_program_;
+  /* Ground fluent for total-time. */
+  const Fluent* total_time_;
+  /* Ground fluent for goal-achieved. */
+  const Fluent* goal_achieved_;
   /* Instantiated actions. */
   ActionSet actions_;
+  /* Instantiated actions, indexed by action index. */
+  ActionList indexed_actions_;
+  /* Actions keyed on a positive atom in their precondition, indexed
+     by the index of the key atom. */
+  std::vector<ActionList> keyed_actions_;
+  /* Actions without a key atom. */
+  ActionList unkeyed_actions_;
+  /* Actions with preconditions that mention a given atom, indexed by
+     atom index. */
+  std::vector<ActionList> atom_dependents_;
+  /* Actions with preconditions that mention a given fluent, indexed
+     by fluent index. */
+  std::vector<ActionList> fluent_dependents_;
+  /* Actions with preconditions whose dependencies are unknown. */
+  ActionList volatile_actions_;
+  /* XML for atoms in a state, indexed by atom index. */
+  std::vector<std::string> atom_xml_;
+  /* XML for fluents in a state up to the value, indexed by fluent
+     index. */
+  std::vector<std::string> fluent_xml_;
+
+  /* Drops the instantiated actions that cannot become enabled when
+     delete effects are ignored. */
+  void prune_unreachable_actions();
+
+  /* Indexes the instantiated actions by their preconditions. */
+  void index_actions();
+
+  /* Builds the XML for the indexed atoms and fluents. */
+  void build_xml();
 };
 
 /* Output operator for problems. */
@@ -0,0 +1,594 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "programs.h"
+#include "effects.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <typeinfo>
+
+
+/* Returns the value of the fluent with the given index in the given
+   state. */
+static const Number& fluent_value(const ValueMap& values, size_t index) {
+  const Number* value = values.value(index);
+  if (value == 0) {
+    throw std::logic_error("value of fluent is undefined");
+  }
+  return *value;
+}
+
+
+/* ====================================================================== */
+/* ExpressionProgram */
+
+/* Compiles the given ground expression. */
+ExpressionProgram::ExpressionProgram(const Expression& expr) {
+  compile(expr, 0);
+}
+
+
+/* Appends code that sets the register to the value of the given
+   expression, with the given number of values on the stack. */
+void ExpressionProgram::compile(const Expression& expr, size_t depth) {
+  const Computation* comp = dynamic_cast<const Computation*>(&expr);
+  if (comp == 0) {
+    append(LOAD, expr);
+    return;
+  }
+  Opcode opcode;
+  if (typeid(*comp) == typeid(Addition)) {
+    opcode = ADD;
+  } else if (typeid(*comp) == typeid(Subtraction)) {
+    opcode = SUBTRACT;
+  } else if (typeid(*comp) == typeid(Multiplication)) {
+    opcode = MULTIPLY;
+  } else {
+    opcode = DIVIDE;
+  }
+  compile(comp->operand1(), depth);
+  compile_operand(opcode, comp->operand2(), depth);
+  fold();
+}
+
+
+/* Appends code that combines the register with the value of the given
+   expression, with the given number of values on the stack. */
+void ExpressionProgram::compile_operand(Opcode opcode, const Expression& expr,
+                                        size_t depth) {
+  if (dynamic_cast<const Computation*>(&expr) == 0 || depth == MAX_DEPTH) {
+    append(opcode, expr);
+    return;
+  }
+  size_t start = code_.size();
+  code_.push_back(Instruction(PUSH, STACK, 0));
+  compile(expr, depth + 1);
+  if (code_.size() == start + 2) {
+    /* The operand was folded into a single load, so the instruction
+       can take it directly instead of from the stack. */
+    code_[start] = Instruction(opcode,
+                               code_[start + 1].source, code_[start + 1].arg);
+    code_.pop_back();
+  } else {
+    code_.push_back(Instruction(opcode, STACK, 0));
+  }
+}
+
+
+/* Appends an instruction with the given operand. */
+void ExpressionProgram::append(Opcode opcode, const Expression& expr) {
+  const Value* value = dynamic_cast<const Value*>(&expr);
+  if (value != 0) {
+    code_.push_back(Instruction(opcode, CONSTANT, constants_.size()));
+    constants_.push_back(value->value());
+    return;
+  }
+  const Fluent* fluent = dynamic_cast<const Fluent*>(&expr);
+  if (fluent != 0) {
+    code_.push_back(Instruction(opcode, FLUENT, fluent->index()));
+    return;
+  }
+  code_.push_back(Instruction(opcode, CALL, calls_.size()));
+  calls_.push_back(&expr);
+}
+
+
+/* Replaces the last two instructions by a single load of their result
+   if both take constant operands. */
+void ExpressionProgram::fold() {
+  size_t n = code_.size();
+  if (n < 2) {
+    return;
+  }
+  const Instruction& load = code_[n - 2];
+  const Instruction& op = code_[n - 1];
+  if (load.opcode != LOAD || load.source != CONSTANT
+      || op.source != CONSTANT) {
+    return;
+  }
+  Number result;
+  try {
+    result = apply(op.opcode, constants_[load.arg], constants_[op.arg]);
+  } catch (const std::exception&) {
+    /* Leave computations that fail, such as a division by zero, to
+       fail when the program is evaluated. */
+    return;
+  }
+  /* The constants that follow the loaded one belong to the folded
+     operand. */
+  constants_.resize(load.arg + 1);
+  constants_[load.arg] = result;
+  code_.pop_back();
+}
+
+
+/* Returns the result of the given instruction code applied to the
+   given values. */
+Number ExpressionProgram::apply(Opcode opcode,
+                                const Number& x, const Number& y) {
+  switch (opcode) {
+  case ADD:
+    return x + y;
+  case SUBTRACT:
+    return x - y;
+  case MULTIPLY:
+    return x * y;
+  case DIVIDE:
+    return x / y;
+  default:
+    return y;
+  }
+}
+
+
+/* Returns the value of the expression of this program in the given
+   state. */
+Number ExpressionProgram::value(const ValueMap& values) const {
+  Number stack[MAX_DEPTH];
+  size_t top = 0;
+  Number result = 0;
+  for (std::vector<Instruction>::const_iterator ii = code_.begin();
+       ii != code_.end(); ii++) {
+    const Instruction& inst = *ii;
+    if (inst.opcode == PUSH) {
+      stack[top++] = result;
+      continue;
+    }
+    switch (inst.source) {
+    case CONSTANT:
+      result = apply(inst.opcode, result, constants_[inst.arg]);
+      break;
+    case FLUENT:
+      result = apply(inst.opcode, result, fluent_value(values, inst.arg));
+      break;
+    case CALL:
+      result = apply(inst.opcode, result, calls_[inst.arg]->value(values));
+      break;
+    case STACK:
+      top--;
+      result = apply(inst.opcode, stack[top], result);
+      break;
+    }
+  }
+  return result;
+}
+
+
+/* ====================================================================== */
+/* FormulaProgram */
+
+/* Compiles the given ground state formula. */
+FormulaProgram::FormulaProgram(const StateFormula& formula) {
+  compile(formula);
+}
+
+
+/* Appends code for the given formula to this program. */
+void FormulaProgram::compile(const StateFormula& formula) {
+  if (formula.tautology() || formula.contradiction()) {
+    code_.push_back(Instruction(CONSTANT, formula.tautology()));
+    return;
+  }
+  const Atom* atom = dynamic_cast<const Atom*>(&formula);
+  if (atom != 0) {
+    code_.push_back(Instruction(ATOM, atom->index()));
+    return;
+  }
+  const Negation* neg = dynamic_cast<const Negation*>(&formula);
+  if (neg != 0) {
+    compile(neg->negand());
+    code_.push_back(Instruction(NOT, 0));
+    return;
+  }
+  const Conjunction* conj = dynamic_cast<const Conjunction*>(&formula);
+  const Disjunction* disj = dynamic_cast<const Disjunction*>(&formula);
+  if (conj != 0 || disj != 0) {
+    /* Every operand but the last jumps to the end of the list as soon
+       as it decides the outcome. */
+    const FormulaList& operands =
+      (conj != 0) ? conj->conjuncts() : disj->disjuncts();
+    if (operands.empty()) {
+      code_.push_back(Instruction(CONSTANT, conj != 0));
+      return;
+    }
+    std::vector<size_t> jumps;
+    for (size_t i = 0; i < operands.size(); i++) {
+      compile(*operands[i]);
+      if (i + 1 < operands.size()) {
+        jumps.push_back(code_.size());
+        code_.push_back(Instruction((conj != 0)
+                                    ? JUMP_IF_FALSE : JUMP_IF_TRUE, 0));
+      }
+    }
+    for (size_t i = 0; i < jumps.size(); i++) {
+      code_[jumps[i]].arg = code_.size();
+    }
+    return;
+  }
+  const Comparison* comp = dynamic_cast<const Comparison*>(&formula);
+  if (comp != 0) {
+    Opcode opcode;
+    if (typeid(*comp) == typeid(LessThan)) {
+      opcode = LESS;
+    } else if (typeid(*comp) == typeid(LessThanOrEqualTo)) {
+      opcode = LESS_EQUAL;
+    } else if (typeid(*comp) == typeid(EqualTo)) {
+      opcode = EQUAL;
+    } else if (typeid(*comp) == typeid(GreaterThanOrEqualTo)) {
+      opcode = GREATER_EQUAL;
+    } else {
+      opcode = GREATER;
+    }
+    code_.push_back(Instruction(opcode, operands_.size()));
+    operands_.push_back(ExpressionProgram(comp->expr1()));
+    operands_.push_back(ExpressionProgram(comp->expr2()));
+    return;
+  }
+  code_.push_back(Instruction(CALL, calls_.size()));
+  calls_.push_back(&formula);
+}
+
+
+/* Tests if the formula of this program holds in the given state. */
+bool FormulaProgram::holds(const TermTable& terms,
+                           const AtomSet& atoms, const ValueMap& values) const {
+  bool result = false;
+  size_t pc = 0;
+  while (pc < code_.size()) {
+    const Instruction& inst = code_[pc++];
+    switch (inst.opcode) {
+    case CONSTANT:
+      result = inst.arg != 0;
+      break;
+    case ATOM:
+      result = atoms.contains(inst.arg);
+      break;
+    case NOT:
+      result = !result;
+      break;
+    case JUMP_IF_FALSE:
+      if (!result) {
+        pc = inst.arg;
+      }
+      break;
+    case JUMP_IF_TRUE:
+      if (result) {
+        pc = inst.arg;
+      }
+      break;
+    case LESS:
+      result = (operands_[inst.arg].value(values)
+                < operands_[inst.arg + 1].value(values));
+      break;
+    case LESS_EQUAL:
+      result = (operands_[inst.arg].value(values)
+                <= operands_[inst.arg + 1].value(values));
+      break;
+    case EQUAL:
+      result = (operands_[inst.arg].value(values)
+                == operands_[inst.arg + 1].value(values));
+      break;
+    case GREATER_EQUAL:
+      result = (operands_[inst.arg].value(values)
+                >= operands_[inst.arg + 1].value(values));
+      break;
+    case GREATER:
+      result = (operands_[inst.arg].value(values)
+                > operands_[inst.arg + 1].value(values));
+      break;
+    case CALL:
+      result = calls_[inst.arg]->holds(terms, atoms, values);
+      break;
+    }
+  }
+  return result;
+}
+
+
+/* ====================================================================== */
+/* EffectProgram */
+
+/* Orders mask words by word index. */
+struct MaskWordLess {
+  template<typename T>
+  bool operator()(const T& m1, const T& m2) const { return m1.word < m2.word; }
+};
+
+
+/* Compiles the given ground effect. */
+EffectProgram::EffectProgram(const Effect& effect) : compiled_(false) {
+  bool open = false;
+  if (!compile(effect, true, open)) {
+    *this = EffectProgram();
+    return;
+  }
+  blocks_.push_back(Block(block_deletes_.size(), block_adds_.size(),
+                          updates_.size()));
+  merge(deletes_);
+  merge(adds_);
+  compiled_ = true;
+}
+
+
+/* Appends code for the given effect to this program.  Parts of an
+   unconditional effect always apply; open is true if a block is open
+   for the atoms and updates of the effect.  Returns false if the
+   effect cannot be compiled. */
+bool EffectProgram::compile(const Effect& effect, bool unconditional,
+                            bool& open) {
+  if (&effect == &Effect::EMPTY) {
+    return true;
+  } else if (const SimpleEffect* se =
+             dynamic_cast<const SimpleEffect*>(&effect)) {
+    bool add = dynamic_cast<const AddEffect*>(se) != 0;
+    size_t index = se->atom().index();
+    if (unconditional) {
+      add_bit(add ? adds_ : deletes_, 0, index);
+    } else {
+      if (!open_block(false, open)) {
+        return false;
+      }
+      if (add) {
+        add_bit(block_adds_, blocks_.back().adds, index);
+      } else {
+        add_bit(block_deletes_, blocks_.back().deletes, index);
+      }
+    }
+    return true;
+  } else if (const UpdateEffect* ue =
+             dynamic_cast<const UpdateEffect*>(&effect)) {
+    if (!open_block(unconditional, open)) {
+      return false;
+    }
+    updates_.push_back(&ue->update());
+    return true;
+  } else if (const ConjunctiveEffect* ce =
+             dynamic_cast<const ConjunctiveEffect*>(&effect)) {
+    for (EffectList::const_iterator ei = ce->conjuncts().begin();
+         ei != ce->conjuncts().end(); ei++) {
+      if (!compile(**ei, unconditional, open)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (const ConditionalEffect* ce =
+             dynamic_cast<const ConditionalEffect*>(&effect)) {
+    open = false;
+    size_t test = code_.size();
+    code_.push_back(Instruction(TEST, conditions_.size()));
+    conditions_.push_back(ce);
+    if (!compile(ce->effect(), false, open)) {
+      return false;
+    }
+    open = false;
+    code_[test].target = code_.size();
+    return true;
+  } else if (const ProbabilisticEffect* pe =
+             dynamic_cast<const ProbabilisticEffect*>(&effect)) {
+    open = false;
+    size_t n = pe->size();
+    size_t first = targets_.size();
+    code_.push_back(Instruction(SAMPLE, branches_.size()));
+    branches_.push_back(Branch(pe, first));
+    targets_.resize(first + n + 1);
+    std::vector<size_t> jumps;
+    for (size_t i = 0; i < n; i++) {
+      targets_[first + i] = code_.size();
+      if (!compile(pe->effect(i), false, open)) {
+        return false;
+      }
+      open = false;
+      if (i + 1 < n) {
+        jumps.push_back(code_.size());
+        code_.push_back(Instruction(JUMP, 0));
+      }
+    }
+    targets_[first + n] = code_.size();
+    for (std::vector<size_t>::const_iterator ji = jumps.begin();
+         ji != jumps.end(); ji++) {
+      code_[*ji].target = code_.size();
+    }
+    return true;
+  } else {
+    /* Quantified effects are expanded by instantiation, so anything
+       else is left to the effect itself. */
+    return false;
+  }
+}
+
+
+/* Opens a new block unless one is already open.  Returns false if
+   there are too many blocks. */
+bool EffectProgram::open_block(bool unconditional, bool& open) {
+  if (!open) {
+    size_t b = blocks_.size();
+    if (b == MAX_BLOCKS) {
+      return false;
+    }
+    blocks_.push_back(Block(block_deletes_.size(), block_adds_.size(),
+                            updates_.size()));
+    if (unconditional) {
+      if (always_.size() <= b/64) {
+        always_.resize(b/64 + 1, 0);
+      }
+      always_[b/64] |= uint64_t(1) << (b%64);
+    } else {
+      code_.push_back(Instruction(ENABLE, b));
+    }
+    open = true;
+  }
+  return true;
+}
+
+
+/* Adds the bit for the atom with the given index to the given mask
+   words, merging it into the last word if that word has the same
+   index and is at or after the given start. */
+void EffectProgram::add_bit(std::vector<MaskWord>& masks, size_t start,
+                            size_t index) {
+  size_t word = index/AtomSet::WORD_BITS;
+  AtomSet::Word bit = AtomSet::Word(1) << (index%AtomSet::WORD_BITS);
+  if (masks.size() > start && masks.back().word == word) {
+    masks.back().bits |= bit;
+  } else {
+    masks.push_back(MaskWord(word, bit));
+  }
+}
+
+
+/* Sorts the given mask words by word index and merges words with the
+   same index. */
+void EffectProgram::merge(std::vector<MaskWord>& masks) {
+  std::stable_sort(masks.begin(), masks.end(), MaskWordLess());
+  size_t n = 0;
+  for (size_t i = 0; i < masks.size(); i++) {
+    if (n > 0 && masks[n - 1].word == masks[i].word) {
+      masks[n - 1].bits |= masks[i].bits;
+    } else {
+      masks[n++] = masks[i];
+    }
+  }
+  masks.resize(n, MaskWord(0, 0));
+}
+
+
+/* Deletes or adds the atoms of the given range of mask words, and
+   appends the atoms that changed to the given list unless it is
+   null. */
+void EffectProgram::change(AtomSet& atoms, const std::vector<MaskWord>& masks,
+                           size_t first, size_t last, bool add,
+                           AtomList* changed_atoms) {
+  for (size_t i = first; i < last; i++) {
+    const MaskWord& mask = masks[i];
+    AtomSet::Word old_bits;
+    AtomSet::Word changed;
+    if (add) {
+      old_bits = atoms.change_word(mask.word, 0, mask.bits);
+      changed = ~old_bits & mask.bits;
+    } else {
+      old_bits = atoms.change_word(mask.word, mask.bits, 0);
+      changed = old_bits & mask.bits;
+    }
+    if (changed_atoms != 0) {
+      size_t base = mask.word*AtomSet::WORD_BITS;
+      while (changed != 0) {
+        changed_atoms->push_back(
+            Atom::indexed_atom(base + __builtin_ctzl(changed)));
+        changed &= changed - 1;
+      }
+    }
+  }
+}
+
+
+/* Changes the given state according to the effect of this program,
+   and fills the provided lists, unless they are null, with the
+   changed atoms and fluents. */
+void EffectProgram::run(const TermTable& terms, AtomSet& atoms,
+                        ValueMap& values, AtomList* changed_atoms,
+                        FluentList* changed_fluents, Random& random) const {
+  /* Decide which blocks apply, looking only at the unchanged state. */
+  uint64_t enabled[MAX_BLOCKS/64];
+  size_t num_blocks = blocks_.size() - 1;
+  size_t num_words = (num_blocks + 63)/64;
+  std::fill(enabled, enabled + num_words, 0);
+  std::copy(always_.begin(), always_.end(), enabled);
+  size_t pc = 0;
+  while (pc < code_.size()) {
+    const Instruction& inst = code_[pc];
+    switch (inst.opcode) {
+    case TEST:
+      if (conditions_[inst.arg]->condition_holds(terms, atoms, values)) {
+        pc++;
+      } else {
+        pc = inst.target;
+      }
+      break;
+    case SAMPLE: {
+      const Branch& branch = branches_[inst.arg];
+      pc = targets_[branch.first_target + branch.effect->sample(random)];
+      break;
+    }
+    case ENABLE:
+      enabled[inst.arg/64] |= uint64_t(1) << (inst.arg%64);
+      pc++;
+      break;
+    case JUMP:
+      pc = inst.target;
+      break;
+    }
+  }
+
+  /* Apply all deletes before all adds, and the updates last. */
+  change(atoms, deletes_, 0, deletes_.size(), false, changed_atoms);
+  for (size_t w = 0; w < num_words; w++) {
+    for (uint64_t bits = enabled[w]; bits != 0; bits &= bits - 1) {
+      size_t b = w*64 + __builtin_ctzll(bits);
+      change(atoms, block_deletes_, blocks_[b].deletes,
+             blocks_[b + 1].deletes, false, changed_atoms);
+    }
+  }
+  change(atoms, adds_, 0, adds_.size(), true, changed_atoms);
+  for (size_t w = 0; w < num_words; w++) {
+    for (uint64_t bits = enabled[w]; bits != 0; bits &= bits - 1) {
+      size_t b = w*64 + __builtin_ctzll(bits);
+      change(atoms, block_adds_, blocks_[b].adds, blocks_[b + 1].adds, true,
+             changed_atoms);
+    }
+  }
+  for (size_t w = 0; w < num_words; w++) {
+    for (uint64_t bits = enabled[w]; bits != 0; bits &= bits - 1) {
+      size_t b = w*64 + __builtin_ctzll(bits);
+      for (size_t u = blocks_[b].updates; u < blocks_[b + 1].updates; u++) {
+        const Update& update = *updates_[u];
+        if (changed_fluents == 0) {
+          update.affect(values);
+          continue;
+        }
+        const Fluent* fluent = &update.fluent();
+        ValueMap::const_iterator vi = values.find(fluent);
+        if (vi == values.end()) {
+          update.affect(values);
+          changed_fluents->push_back(fluent);
+        } else {
+          Number old_value = (*vi).second;
+          update.affect(values);
+          if (values[fluent] != old_value) {
+            changed_fluents->push_back(fluent);
+          }
+        }
+      }
+    }
+  }
+}
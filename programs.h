@@ -0,0 +1,386 @@
+/* -*-C++-*- */
+/*
+ * Compiled programs for ground formulas, expressions, and effects.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PROGRAMS_H
+#define PROGRAMS_H
+
+#include <config.h>
+#include "formulas.h"
+#include "expressions.h"
+#include "rational.h"
+#include "terms.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Effect;
+struct ConditionalEffect;
+struct ProbabilisticEffect;
+struct Update;
+struct Random;
+
+
+/* ====================================================================== */
+/* ExpressionProgram */
+
+/*
+ * A ground expression compiled into a flat list of instructions.  The
+ * instructions work on a single value register and a small stack:
+ * every arithmetic instruction combines the register with an operand
+ * taken from a constant, a fluent value by index, or the top of the
+ * stack, so that a computation whose second operand is a constant or
+ * a fluent needs no stack at all.  Computations on constants are
+ * folded when the program is compiled.  Subexpressions nested too
+ * deeply for the stack are evaluated by calling the expression
+ * itself.  A program refers to the expression it was compiled from,
+ * which must outlive the program.
+ */
+struct ExpressionProgram {
+  /* Constructs an empty program; an empty program is not compiled. */
+  ExpressionProgram() {}
+
+  /* Compiles the given ground expression.  Fluents that the
+     expression mentions are assigned indices if they have none. */
+  explicit ExpressionProgram(const Expression& expr);
+
+  /* Tests if this program has been compiled from an expression. */
+  bool compiled() const { return !code_.empty(); }
+
+  /* Returns the value of the expression of this program in the given
+     state. */
+  Number value(const ValueMap& values) const;
+
+ private:
+  /* Instruction codes. */
+  enum Opcode {
+    /* Sets the register to the operand. */
+    LOAD,
+    /* Pushes the register onto the stack; takes no operand. */
+    PUSH,
+    /* Combines the register with the operand, and sets the register
+       to the result.  With an operand from the stack, the operand is
+       popped and taken as the left-hand side. */
+    ADD, SUBTRACT, MULTIPLY, DIVIDE
+  };
+
+  /* Operand sources. */
+  enum Source {
+    /* The constant with the argument as index. */
+    CONSTANT,
+    /* The value of the fluent with the argument as index. */
+    FLUENT,
+    /* The value of the expression with the argument as index. */
+    CALL,
+    /* The top of the stack. */
+    STACK
+  };
+
+  /* An instruction. */
+  struct Instruction {
+    /* Instruction code. */
+    Opcode opcode;
+    /* Source of the operand. */
+    Source source;
+    /* Argument of the operand source. */
+    uint32_t arg;
+
+    Instruction(Opcode opcode, Source source, uint32_t arg)
+      : opcode(opcode), source(source), arg(arg) {}
+  };
+
+  /* Maximum number of values on the stack. */
+  static const size_t MAX_DEPTH = 8;
+
+  /* Instructions of this program. */
+  std::vector<Instruction> code_;
+  /* Constants of this program. */
+  std::vector<Number> constants_;
+  /* Expressions evaluated by calls. */
+  std::vector<const Expression*> calls_;
+
+  /* Appends code that sets the register to the value of the given
+     expression, with the given number of values on the stack. */
+  void compile(const Expression& expr, size_t depth);
+
+  /* Appends code that combines the register with the value of the
+     given expression, with the given number of values on the
+     stack. */
+  void compile_operand(Opcode opcode, const Expression& expr, size_t depth);
+
+  /* Appends an instruction with the given operand, which must be a
+     constant or a fluent, or is otherwise evaluated by a call. */
+  void append(Opcode opcode, const Expression& expr);
+
+  /* Replaces the last two instructions by a single load of their
+     result if both take constant operands. */
+  void fold();
+
+  /* Returns the result of the given instruction code applied to the
+     given values. */
+  static Number apply(Opcode opcode, const Number& x, const Number& y);
+};
+
+
+/* ====================================================================== */
+/* FormulaProgram */
+
+/*
+ * A ground state formula compiled into a flat list of instructions.
+ * The instructions test atom bits and compare fluent values by index,
+ * and implement conjunctions and disjunctions with short-circuit
+ * jumps, so evaluating the program needs neither virtual calls nor
+ * allocation.  The operands of comparisons are expression programs.
+ * Parts of the formula that cannot be compiled, such as quantified
+ * formulas, are evaluated by calling the formula itself.
+ * A program refers to the formula it was compiled from, which must
+ * outlive the program.
+ */
+struct FormulaProgram {
+  /* Constructs an empty program; an empty program is not compiled. */
+  FormulaProgram() {}
+
+  /* Compiles the given ground state formula.  Atoms and fluents that
+     the formula mentions are assigned indices if they have none. */
+  explicit FormulaProgram(const StateFormula& formula);
+
+  /* Tests if this program has been compiled from a formula. */
+  bool compiled() const { return !code_.empty(); }
+
+  /* Tests if the formula of this program holds in the given state. */
+  bool holds(const TermTable& terms,
+             const AtomSet& atoms, const ValueMap& values) const;
+
+ private:
+  /* Instruction codes.  Every instruction sets or tests a single
+     truth value register. */
+  enum Opcode {
+    /* Sets the register to the argument. */
+    CONSTANT,
+    /* Sets the register to whether the atom with the argument as
+       index holds. */
+    ATOM,
+    /* Negates the register. */
+    NOT,
+    /* Jumps to the argument if the register is false. */
+    JUMP_IF_FALSE,
+    /* Jumps to the argument if the register is true. */
+    JUMP_IF_TRUE,
+    /* Compares the values of the two expression programs starting at
+       the argument, and sets the register to the result. */
+    LESS, LESS_EQUAL, EQUAL, GREATER_EQUAL, GREATER,
+    /* Sets the register to whether the formula with the argument as
+       index holds. */
+    CALL
+  };
+
+  /* An instruction. */
+  struct Instruction {
+    /* Instruction code. */
+    Opcode opcode;
+    /* Argument of the instruction. */
+    uint32_t arg;
+
+    Instruction(Opcode opcode, uint32_t arg) : opcode(opcode), arg(arg) {}
+  };
+
+  /* Instructions of this program. */
+  std::vector<Instruction> code_;
+  /* Operands of comparisons, two per comparison. */
+  std::vector<ExpressionProgram> operands_;
+  /* Formulas evaluated by calls. */
+  std::vector<const StateFormula*> calls_;
+
+  /* Appends code for the given formula to this program. */
+  void compile(const StateFormula& formula);
+};
+
+
+/* ====================================================================== */
+/* EffectProgram */
+
+/*
+ * A ground effect compiled into bit masks and a flat list of
+ * instructions.  The atoms that the effect adds or deletes
+ * unconditionally are kept as masks over the words of an atom set.
+ * The remaining parts of the effect are split into blocks of atoms
+ * and updates, and the instructions decide which blocks apply: they
+ * test effect conditions, sample outcomes of probabilistic effects
+ * from their alias tables, and enable blocks.  Applying the program
+ * first runs the instructions on the unchanged state, and then
+ * applies the deletes, the adds, and the updates of the enabled
+ * blocks, in that order, just like sampling a state change from the
+ * effect itself, but without any allocation.  A program refers to
+ * parts of the effect it was compiled from, which must outlive the
+ * program.
+ */
+struct EffectProgram {
+  /* Constructs an empty program; an empty program is not compiled. */
+  EffectProgram() : compiled_(false) {}
+
+  /* Compiles the given ground effect.  The program is not compiled if
+     the effect contains quantified effects or too many blocks. */
+  explicit EffectProgram(const Effect& effect);
+
+  /* Tests if this program has been compiled from an effect. */
+  bool compiled() const { return compiled_; }
+
+  /* Changes the given state according to the effect of this program,
+     sampled with the given random stream. */
+  void affect(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+              Random& random) const {
+    run(terms, atoms, values, 0, 0, random);
+  }
+
+  /* Changes the given state according to the effect of this program,
+     sampled with the given random stream, and fills the provided
+     lists with the atoms that were added or deleted and the fluents
+     whose values changed. */
+  void affect(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+              AtomList& changed_atoms, FluentList& changed_fluents,
+              Random& random) const {
+    run(terms, atoms, values, &changed_atoms, &changed_fluents, random);
+  }
+
+ private:
+  /* Instruction codes. */
+  enum Opcode {
+    /* Jumps to the target unless the condition with the argument as
+       index holds. */
+    TEST,
+    /* Samples an outcome of the branch with the argument as index, and
+       jumps to the code of the outcome. */
+    SAMPLE,
+    /* Enables the block with the argument as index. */
+    ENABLE,
+    /* Jumps to the target. */
+    JUMP
+  };
+
+  /* An instruction. */
+  struct Instruction {
+    /* Instruction code. */
+    Opcode opcode;
+    /* Argument of the instruction. */
+    uint32_t arg;
+    /* Jump target of the instruction. */
+    uint32_t target;
+
+    Instruction(Opcode opcode, uint32_t arg)
+      : opcode(opcode), arg(arg), target(0) {}
+  };
+
+  /* Bits of a word of an atom set. */
+  struct MaskWord {
+    /* Index of the word. */
+    size_t word;
+    /* Bits of the word. */
+    AtomSet::Word bits;
+
+    MaskWord(size_t word, AtomSet::Word bits) : word(word), bits(bits) {}
+  };
+
+  /* A probabilistic effect; the code of its outcomes starts at the
+     targets with indices starting at first_target, followed by the
+     target for when no outcome is sampled. */
+  struct Branch {
+    /* The probabilistic effect. */
+    const ProbabilisticEffect* effect;
+    /* Index of the first target. */
+    uint32_t first_target;
+
+    Branch(const ProbabilisticEffect* effect, uint32_t first_target)
+      : effect(effect), first_target(first_target) {}
+  };
+
+  /* A block of atoms and updates; each block extends to the start of
+     the next block. */
+  struct Block {
+    /* Index of the first delete mask word of this block. */
+    uint32_t deletes;
+    /* Index of the first add mask word of this block. */
+    uint32_t adds;
+    /* Index of the first update of this block. */
+    uint32_t updates;
+
+    Block(uint32_t deletes, uint32_t adds, uint32_t updates)
+      : deletes(deletes), adds(adds), updates(updates) {}
+  };
+
+  /* Maximum number of blocks. */
+  static const size_t MAX_BLOCKS = 1024;
+
+  /* Whether this program has been compiled. */
+  bool compiled_;
+  /* Atoms deleted unconditionally, by word. */
+  std::vector<MaskWord> deletes_;
+  /* Atoms added unconditionally, by word. */
+  std::vector<MaskWord> adds_;
+  /* Instructions of this program. */
+  std::vector<Instruction> code_;
+  /* Conditional effects tested by this program. */
+  std::vector<const ConditionalEffect*> conditions_;
+  /* Probabilistic effects sampled by this program. */
+  std::vector<Branch> branches_;
+  /* Jump targets of branches. */
+  std::vector<uint32_t> targets_;
+  /* Blocks of this program, followed by an end marker. */
+  std::vector<Block> blocks_;
+  /* Blocks that are always enabled, as a bitset. */
+  std::vector<uint64_t> always_;
+  /* Atoms deleted by blocks. */
+  std::vector<MaskWord> block_deletes_;
+  /* Atoms added by blocks. */
+  std::vector<MaskWord> block_adds_;
+  /* Updates of blocks. */
+  std::vector<const Update*> updates_;
+
+  /* Appends code for the given effect to this program.  Parts of an
+     unconditional effect always apply; open is true if a block is
+     open for the atoms and updates of the effect.  Returns false if
+     the effect cannot be compiled. */
+  bool compile(const Effect& effect, bool unconditional, bool& open);
+
+  /* Opens a new block unless one is already open.  Returns false if
+     there are too many blocks. */
+  bool open_block(bool unconditional, bool& open);
+
+  /* Adds the bit for the atom with the given index to the given mask
+     words, merging it into the last word if that word has the same
+     index and is at or after the given start. */
+  static void add_bit(std::vector<MaskWord>& masks, size_t start,
+                      size_t index);
+
+  /* Sorts the given mask words by word index and merges words with the
+     same index. */
+  static void merge(std::vector<MaskWord>& masks);
+
+  /* Deletes or adds the atoms of the given range of mask words, and
+     appends the atoms that changed to the given list unless it is
+     null. */
+  static void change(AtomSet& atoms, const std::vector<MaskWord>& masks,
+                     size_t first, size_t last, bool add,
+                     AtomList* changed_atoms);
+
+  /* Changes the given state according to the effect of this program,
+     and fills the provided lists, unless they are null, with the
+     changed atoms and fluents. */
+  void run(const TermTable& terms, AtomSet& atoms, ValueMap& values,
+           AtomList* changed_atoms, FluentList* changed_fluents,
+           Random& random) const;
+};
+
+
+#endif /* PROGRAMS_H */
@@ -0,0 +1,96 @@
+/* -*-C++-*- */
+/*
+ * Pseudo-random number generation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+
+/* ====================================================================== */
+/* Random */
+
+/*
+ * A stream of pseudo-random numbers generated with xoshiro256**.  A
+ * stream can be split into non-overlapping substreams, for example
+ * one per session or thread, by copying it and jumping the original
+ * ahead.
+ */
+struct Random {
+  /* Constructs a stream seeded with the given value. */
+  explicit Random(uint64_t seed = 0) {
+    for (int i = 0; i < 4; i++) {
+      /* Expand the seed with splitmix64, as recommended for xoshiro. */
+      uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+      s_[i] = z ^ (z >> 31);
+    }
+  }
+
+  /* Returns the next 64-bit number of this stream. */
+  uint64_t next() {
+    const uint64_t result = rotl(s_[1]*5, 7)*9;
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return result;
+  }
+
+  /* Returns a number uniformly distributed in [0, 1). */
+  double uniform() { return (next() >> 11)*0x1.0p-53; }
+
+  /* Returns an integer uniformly distributed in [0, n). */
+  uint64_t below(uint64_t n) {
+    return uint64_t(((unsigned __int128) next()*n) >> 64);
+  }
+
+  /* Advances this stream by 2^128 numbers. */
+  void jump() {
+    static const uint64_t JUMP[] = {
+      0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+      0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+    };
+    uint64_t s[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+      for (int b = 0; b < 64; b++) {
+        if (JUMP[i] & (uint64_t(1) << b)) {
+          for (int j = 0; j < 4; j++) {
+            s[j] ^= s_[j];
+          }
+        }
+        next();
+      }
+    }
+    for (int j = 0; j < 4; j++) {
+      s_[j] = s[j];
+    }
+  }
+
+ private:
+  /* State of the generator. */
+  uint64_t s_[4];
+
+  /* Rotates the given number left by the given number of bits. */
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+
+#endif /* RANDOM_H */
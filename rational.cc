@@ -16,19 +16,57 @@
  * limitations under the License.
  */
 #include "rational.h"
-#include <cstdlib>
 #include <stdexcept>
 
 
 /* ====================================================================== */
 /* Rational */
 
+/* Throws an exception for a result that does not fit in 64 bits. */
+static void overflow() {
+  throw std::overflow_error("rational number overflow");
+}
+
+
+/* Returns the sum of the two integers, checking for overflow.  The
+   most negative integer counts as an overflow, so that every integer
+   can be negated. */
+static int64_t checked_add(int64_t n, int64_t m) {
+  int64_t r;
+  if (__builtin_add_overflow(n, m, &r) || r == INT64_MIN) {
+    overflow();
+  }
+  return r;
+}
+
+
+/* Returns the difference of the two integers, checking for
+   overflow. */
+static int64_t checked_sub(int64_t n, int64_t m) {
+  int64_t r;
+  if (__builtin_sub_overflow(n, m, &r) || r == INT64_MIN) {
+    overflow();
+  }
+  return r;
+}
+
+
+/* Returns the product of the two integers, checking for overflow. */
+static int64_t checked_mul(int64_t n, int64_t m) {
+  int64_t r;
+  if (__builtin_mul_overflow(n, m, &r) || r == INT64_MIN) {
+    overflow();
+  }
+  return r;
+}
+
+
 /* Returns the greatest common devisor of the two integers. */
-static int gcd(int n, int m) {
-  int a = abs(n);
-  int b = abs(m);
+static int64_t gcd(int64_t n, int64_t m) {
+  int64_t a = (n < 0) ? -n : n;
+  int64_t b = (m < 0) ? -m : m;
   while (b > 0) {
-    int c = b;
+    int64_t c = b;
     b = a % b;
     a = c;
   }
@@ -37,24 +75,69 @@ static int gcd(int n, int m) {
 
 
 /* Returns the least common multiplier of the two integers. */
-static int lcm(int n, int m) {
-  return n/gcd(n, m)*m;
+static int64_t lcm(int64_t n, int64_t m) {
+  return checked_mul(n/gcd(n, m), m);
+}
+
+
+/* Returns the largest integer not greater than n/m, for positive m. */
+static int64_t floor_div(int64_t n, int64_t m) {
+  int64_t q = n/m;
+  return (n%m != 0 && n < 0) ? q - 1 : q;
+}
+
+
+/* Returns -1, 0, or 1 if n1/d1 is less than, equal to, or greater
+   than n2/d2, for positive denominators. */
+static int compare(int64_t n1, int64_t d1, int64_t n2, int64_t d2) {
+  int64_t a, b;
+  if (d1 == d2) {
+    a = n1;
+    b = n2;
+  } else if (__builtin_mul_overflow(n1, d2, &a)
+             || __builtin_mul_overflow(n2, d1, &b)) {
+    /* The cross products do not fit in 64 bits, so compare the integer
+       parts first, and then the fractional parts by comparing their
+       reciprocals in reverse order. */
+    int64_t i1 = floor_div(n1, d1);
+    int64_t i2 = floor_div(n2, d2);
+    if (i1 != i2) {
+      return (i1 < i2) ? -1 : 1;
+    }
+    int64_t r1 = n1 - i1*d1;
+    int64_t r2 = n2 - i2*d2;
+    if (r1 == 0 || r2 == 0) {
+      return (r1 == r2) ? 0 : ((r1 == 0) ? -1 : 1);
+    }
+    return compare(d2, r2, d1, r1);
+  }
+  return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+
+/* Returns -1, 0, or 1 if q is less than, equal to, or greater than
+   p. */
+static int compare(const Rational& q, const Rational& p) {
+  return compare(q.numerator(), q.denominator(),
+                 p.numerator(), p.denominator());
 }
 
 
 /* Returns the multipliers for the two integers. */
-std::pair<int, int> Rational::multipliers(int n, int m) {
-  int f = lcm(n, m);
+std::pair<int64_t, int64_t> Rational::multipliers(int64_t n, int64_t m) {
+  int64_t f = lcm(n, m);
   return std::make_pair(f/n, f/m);
 }
 
 
 /* Constructs a rational number. */
-Rational::Rational(int n, int m) {
+Rational::Rational(int64_t n, int64_t m) {
   if (m == 0) {
     throw std::runtime_error("division by zero");
+  } else if (n == INT64_MIN || m == INT64_MIN) {
+    overflow();
   } else {
-    int d = gcd(n, m);
+    int64_t d = gcd(n, m);
     numerator_ = n/d;
     denominator_ = m/d;
     if (denominator_ < 0) {
@@ -70,31 +153,31 @@ Rational::Rational(const char* s)
   : numerator_(0) {
   const char* si = s;
   for (; *si != '\0' && *si != '.' && *si != '/'; si++) {
-    numerator_ = 10*numerator_ + (*si - '0');
+    numerator_ = checked_add(checked_mul(10, numerator_), *si - '0');
   }
   if (*si == '/') {
     denominator_ = 0;
     for (si++; *si != '\0'; si++) {
-      denominator_ = 10*denominator_ + (*si - '0');
+      denominator_ = checked_add(checked_mul(10, denominator_), *si - '0');
     }
     if (denominator_ == 0) {
       throw std::runtime_error("division by zero");
     }
-    int d = gcd(numerator_, denominator_);
+    int64_t d = gcd(numerator_, denominator_);
     numerator_ /= d;
     denominator_ /= d;
   } else if (*si == '.') {
-    int a = numerator_;
+    int64_t a = numerator_;
     numerator_ = 0;
     denominator_ = 1;
     for (si++; *si != '\0'; si++) {
-      numerator_ = 10*numerator_ + (*si - '0');
-      denominator_ *= 10;
+      numerator_ = checked_add(checked_mul(10, numerator_), *si - '0');
+      denominator_ = checked_mul(denominator_, 10);
     }
-    int d = gcd(numerator_, denominator_);
+    int64_t d = gcd(numerator_, denominator_);
     numerator_ /= d;
     denominator_ /= d;
-    numerator_ += a*denominator_;
+    numerator_ = checked_add(numerator_, checked_mul(a, denominator_));
   } else {
     denominator_ = 1;
   }
@@ -103,88 +186,89 @@ Rational::Rational(const char* s)
 
 /* Less-than comparison operator for rational numbers. */
 bool operator<(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first < p.numerator()*m.second;
+  return compare(q, p) < 0;
 }
 
 
 /* Less-than-or-equal comparison operator for rational numbers. */
 bool operator<=(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first <= p.numerator()*m.second;
+  return compare(q, p) <= 0;
 }
 
 
 /* Equality comparison operator for rational numbers. */
 bool operator==(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first == p.numerator()*m.second;
+  /* Both numbers are in lowest terms. */
+  return (q.numerator() == p.numerator()
+          && q.denominator() == p.denominator());
 }
 
 
 /* Inequality comparison operator for rational numbers. */
 bool operator!=(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first != p.numerator()*m.second;
+  return !(q == p);
 }
 
 
 /* Greater-than-or-equal comparison operator for rational numbers. */
 bool operator>=(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first >= p.numerator()*m.second;
+  return compare(q, p) >= 0;
 }
 
 
 /* Greater-than comparison operator for rational numbers. */
 bool operator>(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
-    Rational::multipliers(q.denominator(), p.denominator());
-  return q.numerator()*m.first > p.numerator()*m.second;
+  return compare(q, p) > 0;
 }
 
 
 /* Addition operator for rational numbers. */
 Rational operator+(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
+  if (q.integer() && p.integer()) {
+    return Rational(checked_add(q.numerator(), p.numerator()));
+  }
+  std::pair<int64_t, int64_t> m =
     Rational::multipliers(q.denominator(), p.denominator());
-  return Rational(q.numerator()*m.first + p.numerator()*m.second,
-                  q.denominator()*m.first);
+  return Rational(checked_add(checked_mul(q.numerator(), m.first),
+                              checked_mul(p.numerator(), m.second)),
+                  checked_mul(q.denominator(), m.first));
 }
 
 
 /* Subtraction operator for rational numbers. */
 Rational operator-(const Rational& q, const Rational& p) {
-  std::pair<int, int> m =
+  if (q.integer() && p.integer()) {
+    return Rational(checked_sub(q.numerator(), p.numerator()));
+  }
+  std::pair<int64_t, int64_t> m =
     Rational::multipliers(q.denominator(), p.denominator());
-  return Rational(q.numerator()*m.first - p.numerator()*m.second,
-                  q.denominator()*m.first);
+  return Rational(checked_sub(checked_mul(q.numerator(), m.first),
+                              checked_mul(p.numerator(), m.second)),
+                  checked_mul(q.denominator(), m.first));
 }
 
 
 /* Multiplication operator for rational numbers. */
 Rational operator*(const Rational& q, const Rational& p) {
-  int d1 = gcd(q.numerator(), p.denominator());
-  int d2 = gcd(p.numerator(), q.denominator());
-  return Rational((q.numerator()/d1)*(p.numerator()/d2),
-                  (q.denominator()/d2)*(p.denominator()/d1));
+  if (q.integer() && p.integer()) {
+    return Rational(checked_mul(q.numerator(), p.numerator()));
+  }
+  int64_t d1 = gcd(q.numerator(), p.denominator());
+  int64_t d2 = gcd(p.numerator(), q.denominator());
+  return Rational(checked_mul(q.numerator()/d1, p.numerator()/d2),
+                  checked_mul(q.denominator()/d2, p.denominator()/d1));
 }
 
 
 /* Division operator for rational numbers. */
 Rational operator/(const Rational& q, const Rational& p) {
-  if (p == 0) {
+  if (p.numerator() == 0) {
     throw std::runtime_error("division by zero");
   }
-  int d1 = gcd(q.numerator(), p.numerator());
-  int d2 = gcd(p.denominator(), q.denominator());
-  return Rational((q.numerator()/d1)*(p.denominator()/d2),
-                  (q.denominator()/d2)*(p.numerator()/d1));
+  int64_t d1 = gcd(q.numerator(), p.numerator());
+  int64_t d2 = gcd(p.denominator(), q.denominator());
+  return Rational(checked_mul(q.numerator()/d1, p.denominator()/d2),
+                  checked_mul(q.denominator()/d2, p.numerator()/d1));
 }
 
 
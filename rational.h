@@ -21,6 +21,7 @@
 #define RATIONAL_H
 
 #include <config.h>
+#include <cstdint>
 #include <iostream>
 #include <utility>
 
@@ -29,35 +30,46 @@
 /* Rational */
 
 /*
- * A rational number.
+ * A rational number with a 64-bit numerator and denominator, always
+ * in lowest terms with a positive denominator.  Operations on integers
+ * (rational numbers with denominator 1) take fast paths without gcd
+ * computations.  Operations whose result does not fit in 64 bits throw
+ * std::overflow_error instead of silently wrapping around; comparisons
+ * are always exact and never throw.
  */
 struct Rational {
   /* Returns the multipliers for the two integers. */
-  static std::pair<int, int> multipliers(int n, int m);
+  static std::pair<int64_t, int64_t> multipliers(int64_t n, int64_t m);
 
   /* Constructs a rational number. */
   Rational(int n = 0) : numerator_(n), denominator_(1) {}
 
   /* Constructs a rational number. */
-  Rational(int n, int m);
+  Rational(int64_t n) : numerator_(n), denominator_(1) {}
+
+  /* Constructs a rational number. */
+  Rational(int64_t n, int64_t m);
 
   /* Constructs a rational number. */
   Rational(const char* s);
 
   /* Returns the numerator of this rational number. */
-  int numerator() const { return numerator_; }
+  int64_t numerator() const { return numerator_; }
 
   /* Returns the denominator of this rational number. */
-  int denominator() const { return denominator_; }
+  int64_t denominator() const { return denominator_; }
+
+  /* Tests if this rational number is an integer. */
+  bool integer() const { return denominator_ == 1; }
 
   /* Returns the double value of this rational number. */
   double double_value() const { return double(numerator())/denominator(); }
 
  private:
   /* The numerator. */
-  int numerator_;
+  int64_t numerator_;
   /* The denominator. */
-  int denominator_;
+  int64_t denominator_;
 };
 
 /* Less-than comparison operator for rational numbers. */
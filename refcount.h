@@ -20,12 +20,15 @@
 #ifndef REFCOUNT_H
 #define REFCOUNT_H
 
+#include <atomic>
+
 
 /* ====================================================================== */
 /* RCObject */
 
 /*
- * An object with a reference counter.
+ * An object with a reference counter.  The counter is atomic, so
+ * objects can be shared between threads.
  */
 struct RCObject {
   /* Increases the reference count for the given object. */
@@ -46,8 +49,7 @@ struct RCObject {
      if the reference count becomes zero. */
   static void destructive_deref(const RCObject* o) {
     if (o != 0) {
-      o->ref_count_--;
-      if (o->ref_count_ == 0) {
+      if (--o->ref_count_ == 0) {
         delete o;
       }
     }
@@ -65,7 +67,7 @@ struct RCObject {
 
  private:
   /* Reference counter. */
-  mutable unsigned long ref_count_;
+  mutable std::atomic<unsigned long> ref_count_;
 };
 
 
@@ -0,0 +1,1258 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "snapshots.h"
+#include "problems.h"
+#include "domains.h"
+#include "strxml.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * A snapshot file starts with a magic string and a version number,
+ * followed by domain and problem records encoded like the contents of
+ * protocol frames.  Types, terms, atoms, and fluents are referred to
+ * by ids assigned in the order they first appear in the file; a
+ * reference to the next unused id is immediately followed by the
+ * definition of the new entity.  Simple types, predicates, functions,
+ * and objects are all defined up front, in the order of their
+ * original indices, by the record of their domain or problem.
+ */
+
+/* Magic string at the start of a snapshot file. */
+static const char MAGIC[] = "MDPSIMG\n";
+/* Version of the snapshot format. */
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+/* Record types. */
+static const uint8_t DOMAIN_RECORD = 'D';
+static const uint8_t PROBLEM_RECORD = 'P';
+
+
+/* ====================================================================== */
+/* SnapshotWriter */
+
+/*
+ * An encoder of problems into a snapshot.
+ */
+struct SnapshotWriter {
+  /* Constructs a writer of an empty snapshot. */
+  SnapshotWriter();
+
+  /* Returns the encoded snapshot. */
+  const std::string& data() const { return out_; }
+
+  /* Adds the given problem, and its domain if not yet added, to the
+     snapshot. */
+  void add_problem(const Problem& problem);
+
+ private:
+  /* Encoded snapshot. */
+  std::string out_;
+  /* Ids of domains. */
+  std::map<const Domain*, uint32_t> domains_;
+  /* Ids of types. */
+  std::map<Type, uint32_t> types_;
+  /* Ids of predicates. */
+  std::map<Predicate, uint32_t> predicates_;
+  /* Ids of functions. */
+  std::map<Function, uint32_t> functions_;
+  /* Ids of terms. */
+  std::map<Term, uint32_t> terms_;
+  /* Ids of atoms. */
+  std::map<const Atom*, uint32_t> atoms_;
+  /* Ids of fluents. */
+  std::map<const Fluent*, uint32_t> fluents_;
+
+  void add_domain(const Domain& domain);
+  void add_objects(const TermTable& terms);
+  void parameters(const TypeList& types);
+  void type(const Type& type);
+  void predicate(const Predicate& predicate);
+  void function(const Function& function);
+  void term(const Term& term);
+  void atom(const Atom& atom);
+  void fluent(const Fluent& fluent);
+  void rational(const Rational& q);
+  void number(const Number& x);
+  void formula(const StateFormula& formula);
+  void expression(const Expression& expr);
+  void update(const Update& update);
+  void effect(const Effect& effect);
+};
+
+
+/* Constructs a writer of an empty snapshot. */
+SnapshotWriter::SnapshotWriter() {
+  out_.append(MAGIC, sizeof MAGIC - 1);
+  append_u32(out_, SNAPSHOT_VERSION);
+  types_.insert(std::make_pair(TypeTable::OBJECT, 0));
+}
+
+
+/* Adds the given domain to the snapshot. */
+void SnapshotWriter::add_domain(const Domain& domain) {
+  append_u8(out_, DOMAIN_RECORD);
+  append_string(out_, domain.name());
+  const Requirements& r = domain.requirements;
+  bool flags[] = {
+    r.strips, r.typing, r.negative_preconditions,
+    r.disjunctive_preconditions, r.equality, r.existential_preconditions,
+    r.universal_preconditions, r.conditional_effects, r.fluents,
+    r.probabilistic_effects, r.rewards
+  };
+  for (size_t i = 0; i < sizeof flags/sizeof flags[0]; i++) {
+    append_u8(out_, flags[i]);
+  }
+
+  /* Simple types in index order, followed by the pairs of types in the
+     subtype relation. */
+  std::map<Type, std::string> types;
+  for (std::map<std::string, Type>::const_iterator ti =
+         domain.types().types().begin();
+       ti != domain.types().types().end(); ti++) {
+    types.insert(std::make_pair((*ti).second, (*ti).first));
+  }
+  append_u32(out_, types.size());
+  for (std::map<Type, std::string>::const_iterator ti = types.begin();
+       ti != types.end(); ti++) {
+    types_.insert(std::make_pair((*ti).first, types_.size()));
+    append_string(out_, (*ti).second);
+  }
+  std::string pairs;
+  uint32_t num_pairs = 0;
+  for (std::map<Type, std::string>::const_iterator ti = types.begin();
+       ti != types.end(); ti++) {
+    for (std::map<Type, std::string>::const_iterator tj = types.begin();
+         tj != types.end(); tj++) {
+      if (ti != tj && TypeTable::subtype((*ti).first, (*tj).first)) {
+        append_u32(pairs, types_[(*ti).first]);
+        append_u32(pairs, types_[(*tj).first]);
+        num_pairs++;
+      }
+    }
+  }
+  append_u32(out_, num_pairs);
+  out_.append(pairs);
+
+  /* Predicates and functions in index order. */
+  std::map<Predicate, std::string> predicates;
+  for (std::map<std::string, Predicate>::const_iterator pi =
+         domain.predicates().predicates().begin();
+       pi != domain.predicates().predicates().end(); pi++) {
+    predicates.insert(std::make_pair((*pi).second, (*pi).first));
+  }
+  append_u32(out_, predicates.size());
+  for (std::map<Predicate, std::string>::const_iterator pi =
+         predicates.begin(); pi != predicates.end(); pi++) {
+    predicates_.insert(std::make_pair((*pi).first, predicates_.size()));
+    append_string(out_, (*pi).second);
+    append_u8(out_, PredicateTable::static_predicate((*pi).first));
+    parameters(PredicateTable::parameters((*pi).first));
+  }
+  std::map<Function, std::string> functions;
+  for (std::map<std::string, Function>::const_iterator fi =
+         domain.functions().functions().begin();
+       fi != domain.functions().functions().end(); fi++) {
+    functions.insert(std::make_pair((*fi).second, (*fi).first));
+  }
+  append_u32(out_, functions.size());
+  for (std::map<Function, std::string>::const_iterator fi =
+         functions.begin(); fi != functions.end(); fi++) {
+    functions_.insert(std::make_pair((*fi).first, functions_.size()));
+    append_string(out_, (*fi).second);
+    append_u8(out_, FunctionTable::static_function((*fi).first));
+    parameters(FunctionTable::parameters((*fi).first));
+  }
+
+  add_objects(domain.terms());
+}
+
+
+/* Appends the definitions of the objects in the given term table, in
+   index order. */
+void SnapshotWriter::add_objects(const TermTable& terms) {
+  std::map<Term, std::string> objects;
+  for (std::map<std::string, Object>::const_iterator oi =
+         terms.objects().begin();
+       oi != terms.objects().end(); oi++) {
+    objects.insert(std::make_pair((*oi).second, (*oi).first));
+  }
+  append_u32(out_, objects.size());
+  for (std::map<Term, std::string>::const_iterator oi = objects.begin();
+       oi != objects.end(); oi++) {
+    append_string(out_, (*oi).second);
+    terms_.insert(std::make_pair((*oi).first, terms_.size()));
+    type(TermTable::type((*oi).first));
+  }
+}
+
+
+/* Adds the given problem, and its domain if not yet added, to the
+   snapshot. */
+void SnapshotWriter::add_problem(const Problem& problem) {
+  std::map<const Domain*, uint32_t>::const_iterator di =
+    domains_.find(&problem.domain());
+  if (di == domains_.end()) {
+    add_domain(problem.domain());
+    di = domains_.insert(std::make_pair(&problem.domain(),
+                                        domains_.size())).first;
+  }
+  append_u8(out_, PROBLEM_RECORD);
+  append_u32(out_, (*di).second);
+  append_string(out_, problem.name());
+
+  add_objects(problem.terms());
+
+  /* Indexed atoms and fluents of the problem in index order, so that
+     they are indexed in the same order when loaded. */
+  std::set<Predicate> predicates;
+  for (std::map<std::string, Predicate>::const_iterator pi =
+         problem.domain().predicates().predicates().begin();
+       pi != problem.domain().predicates().predicates().end(); pi++) {
+    predicates.insert((*pi).second);
+  }
+  AtomList atoms;
+  for (size_t i = 0; i < Atom::num_indexed(); i++) {
+    const Atom* a = Atom::indexed_atom(i);
+    if (a == 0 || atoms_.find(a) != atoms_.end()
+        || predicates.find(a->predicate()) == predicates.end()) {
+      continue;
+    }
+    bool known_terms = true;
+    for (TermList::const_iterator ti = a->terms().begin();
+         ti != a->terms().end() && known_terms; ti++) {
+      known_terms = (terms_.find(*ti) != terms_.end());
+    }
+    if (known_terms) {
+      atoms.push_back(a);
+    }
+  }
+  append_u32(out_, atoms.size());
+  for (AtomList::const_iterator ai = atoms.begin(); ai != atoms.end(); ai++) {
+    atom(**ai);
+  }
+  std::set<Function> functions;
+  for (std::map<std::string, Function>::const_iterator fi =
+         problem.domain().functions().functions().begin();
+       fi != problem.domain().functions().functions().end(); fi++) {
+    functions.insert((*fi).second);
+  }
+  FluentList fluents;
+  for (size_t i = 0; i < Fluent::num_indexed(); i++) {
+    const Fluent* f = Fluent::indexed_fluent(i);
+    if (f == 0 || fluents_.find(f) != fluents_.end()
+        || functions.find(f->function()) == functions.end()) {
+      continue;
+    }
+    bool known_terms = true;
+    for (TermList::const_iterator ti = f->terms().begin();
+         ti != f->terms().end() && known_terms; ti++) {
+      known_terms = (terms_.find(*ti) != terms_.end());
+    }
+    if (known_terms) {
+      fluents.push_back(f);
+    }
+  }
+  append_u32(out_, fluents.size());
+  for (FluentList::const_iterator fi = fluents.begin();
+       fi != fluents.end(); fi++) {
+    fluent(**fi);
+  }
+
+  /* Initial state, goal, and metric. */
+  append_u32(out_, problem.init_atoms().size());
+  for (AtomSet::const_iterator ai = problem.init_atoms().begin();
+       ai != problem.init_atoms().end(); ai++) {
+    atom(**ai);
+  }
+  append_u32(out_, problem.init_values().size());
+  for (ValueMap::const_iterator vi = problem.init_values().begin();
+       vi != problem.init_values().end(); vi++) {
+    fluent(*(*vi).first);
+    number((*vi).second);
+  }
+  append_u32(out_, problem.init_effects().size());
+  for (EffectList::const_iterator ei = problem.init_effects().begin();
+       ei != problem.init_effects().end(); ei++) {
+    effect(**ei);
+  }
+  formula(problem.goal());
+  append_u8(out_, problem.goal_reward() != 0);
+  if (problem.goal_reward() != 0) {
+    update(*problem.goal_reward());
+  }
+  expression(problem.metric());
+
+  /* Instantiated actions. */
+  append_u32(out_, problem.actions().size());
+  for (ActionSet::const_iterator ai = problem.actions().begin();
+       ai != problem.actions().end(); ai++) {
+    const Action& action = **ai;
+    append_string(out_, action.name());
+    append_u32(out_, action.arguments().size());
+    for (ObjectList::const_iterator oi = action.arguments().begin();
+         oi != action.arguments().end(); oi++) {
+      term(*oi);
+    }
+    formula(action.precondition());
+    effect(action.effect());
+  }
+}
+
+
+/* Appends the parameter types of a predicate or function. */
+void SnapshotWriter::parameters(const TypeList& types) {
+  append_u32(out_, types.size());
+  for (TypeList::const_iterator ti = types.begin(); ti != types.end(); ti++) {
+    type(*ti);
+  }
+}
+
+
+/* Appends a reference to the given type. */
+void SnapshotWriter::type(const Type& type) {
+  std::map<Type, uint32_t>::const_iterator ti = types_.find(type);
+  if (ti != types_.end()) {
+    append_u32(out_, (*ti).second);
+    return;
+  } else if (type.simple()) {
+    throw std::logic_error("simple type missing from snapshot");
+  }
+  /* A union type, defined by its component types. */
+  append_u32(out_, types_.size());
+  types_.insert(std::make_pair(type, types_.size()));
+  TypeSet components;
+  TypeTable::components(components, type);
+  append_u32(out_, components.size());
+  for (TypeSet::const_iterator ti = components.begin();
+       ti != components.end(); ti++) {
+    this->type(*ti);
+  }
+}
+
+
+/* Appends a reference to the given predicate. */
+void SnapshotWriter::predicate(const Predicate& predicate) {
+  std::map<Predicate, uint32_t>::const_iterator pi =
+    predicates_.find(predicate);
+  if (pi == predicates_.end()) {
+    throw std::logic_error("predicate missing from snapshot");
+  }
+  append_u32(out_, (*pi).second);
+}
+
+
+/* Appends a reference to the given function. */
+void SnapshotWriter::function(const Function& function) {
+  std::map<Function, uint32_t>::const_iterator fi =
+    functions_.find(function);
+  if (fi == functions_.end()) {
+    throw std::logic_error("function missing from snapshot");
+  }
+  append_u32(out_, (*fi).second);
+}
+
+
+/* Appends a reference to the given term. */
+void SnapshotWriter::term(const Term& term) {
+  std::map<Term, uint32_t>::const_iterator ti = terms_.find(term);
+  if (ti != terms_.end()) {
+    append_u32(out_, (*ti).second);
+    return;
+  } else if (term.object()) {
+    throw std::logic_error("object missing from snapshot");
+  }
+  /* A variable, defined by its type. */
+  append_u32(out_, terms_.size());
+  terms_.insert(std::make_pair(term, terms_.size()));
+  type(TermTable::type(term));
+}
+
+
+/* Appends a reference to the given atom. */
+void SnapshotWriter::atom(const Atom& atom) {
+  std::map<const Atom*, uint32_t>::const_iterator ai = atoms_.find(&atom);
+  if (ai != atoms_.end()) {
+    append_u32(out_, (*ai).second);
+    return;
+  }
+  append_u32(out_, atoms_.size());
+  atoms_.insert(std::make_pair(&atom, atoms_.size()));
+  predicate(atom.predicate());
+  append_u32(out_, atom.terms().size());
+  for (TermList::const_iterator ti = atom.terms().begin();
+       ti != atom.terms().end(); ti++) {
+    term(*ti);
+  }
+}
+
+
+/* Appends a reference to the given fluent. */
+void SnapshotWriter::fluent(const Fluent& fluent) {
+  std::map<const Fluent*, uint32_t>::const_iterator fi =
+    fluents_.find(&fluent);
+  if (fi != fluents_.end()) {
+    append_u32(out_, (*fi).second);
+    return;
+  }
+  append_u32(out_, fluents_.size());
+  fluents_.insert(std::make_pair(&fluent, fluents_.size()));
+  function(fluent.function());
+  append_u32(out_, fluent.terms().size());
+  for (TermList::const_iterator ti = fluent.terms().begin();
+       ti != fluent.terms().end(); ti++) {
+    term(*ti);
+  }
+}
+
+
+/* Appends the given rational number. */
+void SnapshotWriter::rational(const Rational& q) {
+  append_i64(out_, q.numerator());
+  append_i64(out_, q.denominator());
+}
+
+
+/* Appends the given fluent value.  A double value is written as its
+   bit pattern in place of the numerator, with a denominator of 0. */
+void SnapshotWriter::number(const Number& x) {
+#ifdef DOUBLE_VALUES
+  int64_t bits;
+  std::memcpy(&bits, &x, sizeof bits);
+  append_i64(out_, bits);
+  append_i64(out_, 0);
+#else
+  rational(x);
+#endif
+}
+
+
+/* Appends the given state formula. */
+void SnapshotWriter::formula(const StateFormula& formula) {
+  if (formula.tautology()) {
+    append_u8(out_, 'T');
+    return;
+  } else if (formula.contradiction()) {
+    append_u8(out_, 'F');
+    return;
+  }
+  const Atom* af = dynamic_cast<const Atom*>(&formula);
+  if (af != 0) {
+    append_u8(out_, 'a');
+    atom(*af);
+    return;
+  }
+  const Equality* eq = dynamic_cast<const Equality*>(&formula);
+  if (eq != 0) {
+    append_u8(out_, '=');
+    term(eq->term1());
+    term(eq->term2());
+    return;
+  }
+  const Comparison* cf = dynamic_cast<const Comparison*>(&formula);
+  if (cf != 0) {
+    if (dynamic_cast<const LessThan*>(cf) != 0) {
+      append_u8(out_, '<');
+    } else if (dynamic_cast<const LessThanOrEqualTo*>(cf) != 0) {
+      append_u8(out_, 'l');
+    } else if (dynamic_cast<const EqualTo*>(cf) != 0) {
+      append_u8(out_, 'e');
+    } else if (dynamic_cast<const GreaterThanOrEqualTo*>(cf) != 0) {
+      append_u8(out_, 'g');
+    } else {
+      append_u8(out_, '>');
+    }
+    expression(cf->expr1());
+    expression(cf->expr2());
+    return;
+  }
+  const Negation* nf = dynamic_cast<const Negation*>(&formula);
+  if (nf != 0) {
+    append_u8(out_, '!');
+    this->formula(nf->negand());
+    return;
+  }
+  const Conjunction* cj = dynamic_cast<const Conjunction*>(&formula);
+  if (cj != 0) {
+    append_u8(out_, '&');
+    append_u32(out_, cj->conjuncts().size());
+    for (FormulaList::const_iterator fi = cj->conjuncts().begin();
+         fi != cj->conjuncts().end(); fi++) {
+      this->formula(**fi);
+    }
+    return;
+  }
+  const Disjunction* dj = dynamic_cast<const Disjunction*>(&formula);
+  if (dj != 0) {
+    append_u8(out_, '|');
+    append_u32(out_, dj->disjuncts().size());
+    for (FormulaList::const_iterator fi = dj->disjuncts().begin();
+         fi != dj->disjuncts().end(); fi++) {
+      this->formula(**fi);
+    }
+    return;
+  }
+  const Quantification* qf = dynamic_cast<const Quantification*>(&formula);
+  if (qf != 0) {
+    append_u8(out_, (dynamic_cast<const Exists*>(qf) != 0) ? 'E' : 'A');
+    append_u32(out_, qf->parameters().size());
+    for (VariableList::const_iterator vi = qf->parameters().begin();
+         vi != qf->parameters().end(); vi++) {
+      term(*vi);
+    }
+    this->formula(qf->body());
+    return;
+  }
+  throw std::logic_error("unexpected state formula");
+}
+
+
+/* Appends the given expression. */
+void SnapshotWriter::expression(const Expression& expr) {
+  const Value* ve = dynamic_cast<const Value*>(&expr);
+  if (ve != 0) {
+    append_u8(out_, 'v');
+    number(ve->value());
+    return;
+  }
+  const Fluent* fe = dynamic_cast<const Fluent*>(&expr);
+  if (fe != 0) {
+    append_u8(out_, 'f');
+    fluent(*fe);
+    return;
+  }
+  const Computation* ce = dynamic_cast<const Computation*>(&expr);
+  if (ce != 0) {
+    if (dynamic_cast<const Addition*>(ce) != 0) {
+      append_u8(out_, '+');
+    } else if (dynamic_cast<const Subtraction*>(ce) != 0) {
+      append_u8(out_, '-');
+    } else if (dynamic_cast<const Multiplication*>(ce) != 0) {
+      append_u8(out_, '*');
+    } else {
+      append_u8(out_, '/');
+    }
+    expression(ce->operand1());
+    expression(ce->operand2());
+    return;
+  }
+  throw std::logic_error("unexpected expression");
+}
+
+
+/* Appends the given update. */
+void SnapshotWriter::update(const Update& update) {
+  if (dynamic_cast<const Assign*>(&update) != 0) {
+    append_u8(out_, '=');
+  } else if (dynamic_cast<const ScaleUp*>(&update) != 0) {
+    append_u8(out_, '*');
+  } else if (dynamic_cast<const ScaleDown*>(&update) != 0) {
+    append_u8(out_, '/');
+  } else if (dynamic_cast<const Increase*>(&update) != 0) {
+    append_u8(out_, '+');
+  } else {
+    append_u8(out_, '-');
+  }
+  fluent(update.fluent());
+  expression(update.expression());
+}
+
+
+/* Appends the given effect. */
+void SnapshotWriter::effect(const Effect& effect) {
+  if (effect.empty()) {
+    append_u8(out_, '0');
+    return;
+  }
+  const AddEffect* ae = dynamic_cast<const AddEffect*>(&effect);
+  if (ae != 0) {
+    append_u8(out_, '+');
+    atom(ae->atom());
+    return;
+  }
+  const DeleteEffect* de = dynamic_cast<const DeleteEffect*>(&effect);
+  if (de != 0) {
+    append_u8(out_, '-');
+    atom(de->atom());
+    return;
+  }
+  const UpdateEffect* ue = dynamic_cast<const UpdateEffect*>(&effect);
+  if (ue != 0) {
+    append_u8(out_, 'u');
+    update(ue->update());
+    return;
+  }
+  const ConjunctiveEffect* ce =
+    dynamic_cast<const ConjunctiveEffect*>(&effect);
+  if (ce != 0) {
+    append_u8(out_, '&');
+    append_u32(out_, ce->conjuncts().size());
+    for (EffectList::const_iterator ei = ce->conjuncts().begin();
+         ei != ce->conjuncts().end(); ei++) {
+      this->effect(**ei);
+    }
+    return;
+  }
+  const ConditionalEffect* we =
+    dynamic_cast<const ConditionalEffect*>(&effect);
+  if (we != 0) {
+    append_u8(out_, '?');
+    formula(we->condition());
+    this->effect(we->effect());
+    return;
+  }
+  const ProbabilisticEffect* pe =
+    dynamic_cast<const ProbabilisticEffect*>(&effect);
+  if (pe != 0) {
+    append_u8(out_, 'p');
+    append_u32(out_, pe->size());
+    for (size_t i = 0; i < pe->size(); i++) {
+      rational(pe->probability(i));
+      this->effect(pe->effect(i));
+    }
+    return;
+  }
+  const QuantifiedEffect* qe = dynamic_cast<const QuantifiedEffect*>(&effect);
+  if (qe != 0) {
+    append_u8(out_, 'A');
+    append_u32(out_, qe->parameters().size());
+    for (VariableList::const_iterator vi = qe->parameters().begin();
+         vi != qe->parameters().end(); vi++) {
+      term(*vi);
+    }
+    this->effect(qe->effect());
+    return;
+  }
+  throw std::logic_error("unexpected effect");
+}
+
+
+/* Saves all defined problems to a snapshot file with the given name. */
+void save_grounded(const std::string& name) {
+  SnapshotWriter writer;
+  for (Problem::ProblemMap::const_iterator pi = Problem::begin();
+       pi != Problem::end(); pi++) {
+    writer.add_problem(*(*pi).second);
+  }
+  std::ofstream out(name.c_str(), std::ios::out | std::ios::binary);
+  out.write(writer.data().data(), writer.data().size());
+  out.close();
+  if (!out) {
+    throw std::runtime_error("cannot write snapshot `" + name + "'");
+  }
+}
+
+
+/* ====================================================================== */
+/* SnapshotReader */
+
+/*
+ * A decoder of the problems in a snapshot.
+ */
+struct SnapshotReader {
+  /* Constructs a reader of the given snapshot contents. */
+  SnapshotReader(const std::string& name, std::string_view data)
+    : name_(name), in_(data) {
+    types_.push_back(TypeTable::OBJECT);
+  }
+
+  /* Deletes this reader, releasing its references to atoms and
+     fluents. */
+  ~SnapshotReader();
+
+  /* Defines the domains and problems of the snapshot. */
+  void load();
+
+ private:
+  /* Name of the snapshot file. */
+  std::string name_;
+  /* Snapshot contents not yet decoded. */
+  FrameDecoder in_;
+  /* Domains by id. */
+  std::vector<Domain*> domains_;
+  /* Types by id. */
+  TypeList types_;
+  /* Predicates by id. */
+  std::vector<Predicate> predicates_;
+  /* Functions by id. */
+  std::vector<Function> functions_;
+  /* Terms by id. */
+  TermList terms_;
+  /* Atoms by id. */
+  AtomList atoms_;
+  /* Fluents by id. */
+  FluentList fluents_;
+
+  [[noreturn]] void malformed() const;
+  uint8_t u8();
+  uint32_t u32();
+  std::string string();
+  uint32_t index(size_t count);
+  uint32_t id(size_t count);
+  void load_domain();
+  void load_problem();
+  void load_object(TermTable& terms);
+  TypeList parameters();
+  Type type();
+  Term term();
+  const Atom& atom();
+  const Fluent& fluent();
+  Rational rational();
+  Number number();
+  const StateFormula& formula();
+  const Expression& expression();
+  const Update& update();
+  const Effect& effect();
+};
+
+
+/* Deletes this reader. */
+SnapshotReader::~SnapshotReader() {
+  for (AtomList::const_iterator ai = atoms_.begin();
+       ai != atoms_.end(); ai++) {
+    RCObject::destructive_deref(*ai);
+  }
+  for (FluentList::const_iterator fi = fluents_.begin();
+       fi != fluents_.end(); fi++) {
+    RCObject::destructive_deref(*fi);
+  }
+}
+
+
+/* Reports malformed snapshot contents. */
+void SnapshotReader::malformed() const {
+  throw std::runtime_error("malformed snapshot `" + name_ + "'");
+}
+
+
+/* Decodes an 8-bit integer. */
+uint8_t SnapshotReader::u8() {
+  uint8_t n;
+  if (!in_.u8(n)) {
+    malformed();
+  }
+  return n;
+}
+
+
+/* Decodes a 32-bit integer. */
+uint32_t SnapshotReader::u32() {
+  uint32_t n;
+  if (!in_.u32(n)) {
+    malformed();
+  }
+  return n;
+}
+
+
+/* Decodes a string. */
+std::string SnapshotReader::string() {
+  std::string_view s;
+  if (!in_.string(s)) {
+    malformed();
+  }
+  return std::string(s);
+}
+
+
+/* Decodes a reference to one of the given number of entities. */
+uint32_t SnapshotReader::index(size_t count) {
+  uint32_t n = u32();
+  if (n >= count) {
+    malformed();
+  }
+  return n;
+}
+
+
+/* Decodes a reference to one of the given number of entities, or to
+   the next entity if it is defined by the reference. */
+uint32_t SnapshotReader::id(size_t count) {
+  uint32_t n = u32();
+  if (n > count) {
+    malformed();
+  }
+  return n;
+}
+
+
+/* Defines the domains and problems of the snapshot. */
+void SnapshotReader::load() {
+  while (!in_.empty()) {
+    uint8_t record = u8();
+    if (record == DOMAIN_RECORD) {
+      load_domain();
+    } else if (record == PROBLEM_RECORD) {
+      load_problem();
+    } else {
+      malformed();
+    }
+  }
+}
+
+
+/* Decodes a domain record. */
+void SnapshotReader::load_domain() {
+  Domain* domain = new Domain(string());
+  domains_.push_back(domain);
+  Requirements& r = domain->requirements;
+  bool* flags[] = {
+    &r.strips, &r.typing, &r.negative_preconditions,
+    &r.disjunctive_preconditions, &r.equality, &r.existential_preconditions,
+    &r.universal_preconditions, &r.conditional_effects, &r.fluents,
+    &r.probabilistic_effects, &r.rewards
+  };
+  for (size_t i = 0; i < sizeof flags/sizeof flags[0]; i++) {
+    *flags[i] = u8();
+  }
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    types_.push_back(domain->types().add_type(string()));
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    uint32_t t1 = index(types_.size());
+    uint32_t t2 = index(types_.size());
+    if (!TypeTable::add_supertype(types_[t1], types_[t2])) {
+      malformed();
+    }
+  }
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    std::string name = string();
+    const Predicate* p = domain->predicates().find_predicate(name);
+    if (p == 0) {
+      p = &domain->predicates().add_predicate(name);
+    }
+    predicates_.push_back(*p);
+    bool static_predicate = u8();
+    TypeList params = parameters();
+    for (TypeList::const_iterator ti = params.begin();
+         ti != params.end(); ti++) {
+      PredicateTable::add_parameter(*p, *ti);
+    }
+    if (!static_predicate) {
+      PredicateTable::make_dynamic(*p);
+    }
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    std::string name = string();
+    const Function* f = domain->functions().find_function(name);
+    if (f == 0) {
+      f = &domain->functions().add_function(name);
+    }
+    functions_.push_back(*f);
+    bool static_function = u8();
+    TypeList params = parameters();
+    for (TypeList::const_iterator ti = params.begin();
+         ti != params.end(); ti++) {
+      FunctionTable::add_parameter(*f, *ti);
+    }
+    if (!static_function) {
+      FunctionTable::make_dynamic(*f);
+    }
+  }
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    load_object(domain->terms());
+  }
+}
+
+
+/* Decodes a problem record. */
+void SnapshotReader::load_problem() {
+  const Domain& domain = *domains_[index(domains_.size())];
+  Problem& problem = *new Problem(string(), domain);
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    load_object(problem.terms());
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    atom().index();
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    fluent().index();
+  }
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    problem.add_init_atom(atom());
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    const Fluent& f = fluent();
+    problem.add_init_value(f, number());
+  }
+  for (uint32_t n = u32(); n > 0; n--) {
+    problem.add_init_effect(effect());
+  }
+  problem.set_goal(formula());
+  if (u8()) {
+    problem.set_goal_reward(update());
+  }
+  problem.set_metric(expression());
+
+  for (uint32_t n = u32(); n > 0; n--) {
+    Action& action = *new Action(string());
+    for (uint32_t m = u32(); m > 0; m--) {
+      Term t = term();
+      if (!t.object()) {
+        malformed();
+      }
+      action.add_argument(t.as_object());
+    }
+    action.set_precondition(formula());
+    action.set_effect(effect());
+    problem.add_action(action);
+  }
+  problem.finish_instantiation();
+}
+
+
+/* Decodes the definition of an object and adds it to the given term
+   table. */
+void SnapshotReader::load_object(TermTable& terms) {
+  std::string name = string();
+  terms_.push_back(terms.add_object(name, type()));
+}
+
+
+/* Decodes the parameter types of a predicate or function. */
+TypeList SnapshotReader::parameters() {
+  TypeList params;
+  for (uint32_t n = u32(); n > 0; n--) {
+    params.push_back(type());
+  }
+  return params;
+}
+
+
+/* Decodes a reference to a type. */
+Type SnapshotReader::type() {
+  uint32_t t = id(types_.size());
+  if (t < types_.size()) {
+    return types_[t];
+  }
+  /* A union type, defined by its component types. */
+  types_.push_back(TypeTable::OBJECT);
+  TypeSet components;
+  for (uint32_t n = u32(); n > 0; n--) {
+    components.insert(type());
+  }
+  if (components.empty()) {
+    malformed();
+  }
+  types_[t] = TypeTable::union_type(components);
+  return types_[t];
+}
+
+
+/* Decodes a reference to a term. */
+Term SnapshotReader::term() {
+  uint32_t t = id(terms_.size());
+  if (t < terms_.size()) {
+    return terms_[t];
+  }
+  /* A variable, defined by its type. */
+  terms_.push_back(TermTable::add_variable(TypeTable::OBJECT));
+  TermTable::set_type(terms_[t], type());
+  return terms_[t];
+}
+
+
+/* Decodes a reference to an atom. */
+const Atom& SnapshotReader::atom() {
+  uint32_t a = id(atoms_.size());
+  if (a < atoms_.size()) {
+    return *atoms_[a];
+  }
+  atoms_.push_back(0);
+  Predicate p = predicates_[index(predicates_.size())];
+  TermList terms;
+  for (uint32_t n = u32(); n > 0; n--) {
+    terms.push_back(term());
+  }
+  const Atom& atom = Atom::make(p, terms);
+  RCObject::ref(&atom);
+  atoms_[a] = &atom;
+  return atom;
+}
+
+
+/* Decodes a reference to a fluent. */
+const Fluent& SnapshotReader::fluent() {
+  uint32_t f = id(fluents_.size());
+  if (f < fluents_.size()) {
+    return *fluents_[f];
+  }
+  fluents_.push_back(0);
+  Function function = functions_[index(functions_.size())];
+  TermList terms;
+  for (uint32_t n = u32(); n > 0; n--) {
+    terms.push_back(term());
+  }
+  const Fluent& fluent = Fluent::make(function, terms);
+  RCObject::ref(&fluent);
+  fluents_[f] = &fluent;
+  return fluent;
+}
+
+
+/* Decodes a rational number. */
+Rational SnapshotReader::rational() {
+  int64_t n, m;
+  if (!in_.i64(n) || !in_.i64(m)
+      || m <= 0 || n == INT64_MIN) {
+    malformed();
+  }
+  return Rational(n, m);
+}
+
+
+/* Decodes a fluent value. */
+Number SnapshotReader::number() {
+#ifdef DOUBLE_VALUES
+  int64_t bits, m;
+  if (!in_.i64(bits) || !in_.i64(m) || m != 0) {
+    malformed();
+  }
+  double x;
+  std::memcpy(&x, &bits, sizeof x);
+  return x;
+#else
+  return rational();
+#endif
+}
+
+
+/* Decodes a state formula. */
+const StateFormula& SnapshotReader::formula() {
+  uint8_t tag = u8();
+  switch (tag) {
+  case 'T':
+    return StateFormula::TRUE;
+  case 'F':
+    return StateFormula::FALSE;
+  case 'a':
+    return atom();
+  case '=': {
+    Term t1 = term();
+    return Equality::make(t1, term());
+  }
+  case '<':
+  case 'l':
+  case 'e':
+  case 'g':
+  case '>': {
+    const Expression& e1 = expression();
+    const Expression& e2 = expression();
+    switch (tag) {
+    case '<':
+      return LessThan::make(e1, e2);
+    case 'l':
+      return LessThanOrEqualTo::make(e1, e2);
+    case 'e':
+      return EqualTo::make(e1, e2);
+    case 'g':
+      return GreaterThanOrEqualTo::make(e1, e2);
+    default:
+      return GreaterThan::make(e1, e2);
+    }
+  }
+  case '!':
+    return Negation::make(formula());
+  case '&': {
+    const StateFormula* f = &StateFormula::TRUE;
+    for (uint32_t n = u32(); n > 0; n--) {
+      f = &(*f && formula());
+    }
+    return *f;
+  }
+  case '|': {
+    const StateFormula* f = &StateFormula::FALSE;
+    for (uint32_t n = u32(); n > 0; n--) {
+      f = &(*f || formula());
+    }
+    return *f;
+  }
+  case 'E':
+  case 'A': {
+    VariableList parameters;
+    for (uint32_t n = u32(); n > 0; n--) {
+      Term t = term();
+      if (!t.variable()) {
+        malformed();
+      }
+      parameters.push_back(t.as_variable());
+    }
+    const StateFormula& body = formula();
+    if (tag == 'E') {
+      return Exists::make(parameters, body);
+    } else {
+      return Forall::make(parameters, body);
+    }
+  }
+  default:
+    malformed();
+  }
+}
+
+
+/* Decodes an expression. */
+const Expression& SnapshotReader::expression() {
+  uint8_t tag = u8();
+  switch (tag) {
+  case 'v':
+    return *new Value(number());
+  case 'f':
+    return fluent();
+  case '+':
+  case '-':
+  case '*':
+  case '/': {
+    const Expression& e1 = expression();
+    const Expression& e2 = expression();
+    switch (tag) {
+    case '+':
+      return Addition::make(e1, e2);
+    case '-':
+      return Subtraction::make(e1, e2);
+    case '*':
+      return Multiplication::make(e1, e2);
+    default:
+      return Division::make(e1, e2);
+    }
+  }
+  default:
+    malformed();
+  }
+}
+
+
+/* Decodes an update. */
+const Update& SnapshotReader::update() {
+  uint8_t tag = u8();
+  const Fluent& f = fluent();
+  const Expression& e = expression();
+  switch (tag) {
+  case '=':
+    return *new Assign(f, e);
+  case '*':
+    return *new ScaleUp(f, e);
+  case '/':
+    return *new ScaleDown(f, e);
+  case '+':
+    return *new Increase(f, e);
+  case '-':
+    return *new Decrease(f, e);
+  default:
+    malformed();
+  }
+}
+
+
+/* Decodes an effect. */
+const Effect& SnapshotReader::effect() {
+  switch (u8()) {
+  case '0':
+    return Effect::EMPTY;
+  case '+':
+    return *new AddEffect(atom());
+  case '-':
+    return *new DeleteEffect(atom());
+  case 'u':
+    return UpdateEffect::make(update());
+  case '&': {
+    const Effect* e = &Effect::EMPTY;
+    for (uint32_t n = u32(); n > 0; n--) {
+      e = &(*e && effect());
+    }
+    return *e;
+  }
+  case '?': {
+    const StateFormula& condition = formula();
+    return ConditionalEffect::make(condition, effect());
+  }
+  case 'p': {
+    std::vector<std::pair<Rational, const Effect*> > os;
+    for (uint32_t n = u32(); n > 0; n--) {
+      Rational p = rational();
+      os.push_back(std::make_pair(p, &effect()));
+    }
+    return ProbabilisticEffect::make(os);
+  }
+  case 'A': {
+    VariableList parameters;
+    for (uint32_t n = u32(); n > 0; n--) {
+      Term t = term();
+      if (!t.variable()) {
+        malformed();
+      }
+      parameters.push_back(t.as_variable());
+    }
+    return QuantifiedEffect::make(parameters, effect());
+  }
+  default:
+    malformed();
+  }
+}
+
+
+/* Defines the problems in the snapshot file with the given name, along
+   with their domains.  The file is mapped into memory and decoded in
+   place. */
+void load_grounded(const std::string& name) {
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("cannot open snapshot `" + name + "': "
+                             + strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    throw std::runtime_error("cannot read snapshot `" + name + "': "
+                             + strerror(errno));
+  }
+  size_t size = st.st_size;
+  size_t header = sizeof MAGIC - 1 + 4;
+  void* data = (size >= header
+                ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("cannot read snapshot `" + name + "'");
+  }
+  std::string_view contents(static_cast<const char*>(data), size);
+  try {
+    FrameDecoder in(contents.substr(sizeof MAGIC - 1, 4));
+    uint32_t version;
+    if (contents.compare(0, sizeof MAGIC - 1, MAGIC) != 0
+        || !in.u32(version) || version != SNAPSHOT_VERSION) {
+      throw std::runtime_error("`" + name + "' is not a snapshot"
+                               " of this version of " PACKAGE);
+    }
+    SnapshotReader reader(name, contents.substr(header));
+    reader.load();
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+  munmap(data, size);
+}
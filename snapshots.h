@@ -0,0 +1,45 @@
+/* -*-C++-*- */
+/*
+ * Snapshots of grounded problems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+#include <config.h>
+#include <string>
+
+
+/*
+ * A snapshot holds every defined problem after instantiation, together
+ * with the parts of its domain that the problem refers to: types,
+ * predicates, functions, objects, atoms, fluents, the initial state,
+ * the goal, the metric, and the instantiated actions.  Loading a
+ * snapshot maps the file into memory and rebuilds the problems without
+ * parsing or instantiating action schemas.  Atoms, fluents, and
+ * objects are recreated in the order of their original indices, so a
+ * loaded problem simulates exactly like the problem it was saved from.
+ */
+
+/* Saves all defined problems to a snapshot file with the given name.
+   Throws std::runtime_error if the file cannot be written. */
+void save_grounded(const std::string& name);
+
+/* Defines the problems in the snapshot file with the given name, along
+   with their domains.  Throws std::runtime_error if the file cannot be
+   read or is not a valid snapshot. */
+void load_grounded(const std::string& name);
+
+
+#endif /* SNAPSHOTS_H */
@@ -15,36 +15,166 @@
  * limitations under the License.
  */
 #include "states.h"
+#include <cstring>
+#include <stdexcept>
 
 
 /* Verbosity level. */
 extern int verbosity;
 
 
+/* ====================================================================== */
+/* StateKey */
+
+/* Makes this the key of the state with the given atoms and fluent
+   values, reusing the storage of this key. */
+void StateKey::assign(const AtomSet& atoms, const ValueMap& values) {
+  words_.clear();
+  size_t n = atoms.num_words();
+  while (n > 0 && atoms.word(n - 1) == 0) {
+    n--;
+  }
+  words_.push_back(n);
+  for (size_t i = 0; i < n; i++) {
+    words_.push_back(atoms.word(i));
+  }
+  for (ValueMap::const_iterator vi = values.begin();
+       vi != values.end(); vi++) {
+    words_.push_back((*vi).first->index());
+#ifdef DOUBLE_VALUES
+    /* Negative zero equals zero, so it gets the same bits. */
+    double value = ((*vi).second == 0) ? 0.0 : (*vi).second;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    words_.push_back(bits);
+#else
+    /* Rational numbers are always in lowest terms. */
+    words_.push_back((*vi).second.numerator());
+    words_.push_back((*vi).second.denominator());
+#endif
+  }
+  uint64_t h = 0;
+  for (std::vector<uint64_t>::const_iterator wi = words_.begin();
+       wi != words_.end(); wi++) {
+    h = (h ^ *wi)*0x9e3779b97f4a7c15ULL;
+  }
+  h = (h ^ (h >> 31))*0xbf58476d1ce4e5b9ULL;
+  hash_ = h ^ (h >> 29);
+}
+
+
+/* ====================================================================== */
+/* StateTable */
+
+/* Constructs an empty table with at least the given number of
+   shards. */
+StateTable::StateTable(size_t num_shards) : next_id_(0) {
+  size_t n = 1;
+  while (n < num_shards) {
+    n *= 2;
+  }
+  shards_.reset(new Shard[n]);
+  shard_mask_ = n - 1;
+  for (int s = 0; s < NUM_SEGMENTS; s++) {
+    segments_[s].store(0, std::memory_order_relaxed);
+  }
+}
+
+
+/* Deletes this table. */
+StateTable::~StateTable() {
+  for (int s = 0; s < NUM_SEGMENTS; s++) {
+    delete[] segments_[s].load(std::memory_order_relaxed);
+  }
+}
+
+
+/* Returns the identifier of the given key, or NO_ID if the key is not
+   in this table. */
+uint32_t StateTable::find(const StateKey& key) const {
+  Shard& s = shard(key.hash());
+  std::lock_guard<std::mutex> lock(s.mutex);
+  const Entry* entry = s.table.find(key.hash(), [&](const Entry* e) {
+      return e->key == key;
+    });
+  return (entry != 0) ? entry->id : NO_ID;
+}
+
+
+/* Returns the identifier of the given key, adding the key to this
+   table if needed, and whether the key was added. */
+std::pair<uint32_t, bool> StateTable::intern(const StateKey& key) {
+  Shard& s = shard(key.hash());
+  std::lock_guard<std::mutex> lock(s.mutex);
+  const Entry* entry = s.table.find(key.hash(), [&](const Entry* e) {
+      return e->key == key;
+    });
+  if (entry != 0) {
+    return std::make_pair(entry->id, false);
+  }
+  uint64_t id = next_id_.fetch_add(1);
+  if (id >= NO_ID) {
+    next_id_.fetch_sub(1);
+    throw std::overflow_error("too many states in state table");
+  }
+  s.entries.push_back(Entry(key, id));
+  s.table.insert(&s.entries.back(), key.hash());
+  publish(id, s.entries.back().key);
+  return std::make_pair(uint32_t(id), true);
+}
+
+
+/* Records the given key as the key with the given identifier. */
+void StateTable::publish(uint32_t id, const StateKey& key) {
+  uint64_t n = uint64_t(id) + 1;
+  int s = 63 - __builtin_clzll(n);
+  const StateKey** segment = segments_[s].load(std::memory_order_acquire);
+  if (segment == 0) {
+    const StateKey** fresh = new const StateKey*[size_t(1) << s]();
+    if (segments_[s].compare_exchange_strong(segment, fresh,
+                                             std::memory_order_acq_rel)) {
+      segment = fresh;
+    } else {
+      delete[] fresh;
+    }
+  }
+  segment[n - (1ULL << s)] = &key;
+}
+
+
 /* ====================================================================== */
 /* State */
 
-/* Constructs an initial state for the given problem. */
-State::State(const Problem& problem)
-  : problem_(&problem), atoms_(problem.init_atoms()),
-    values_(problem.init_values()) {
+/* Constructs an initial state for the given problem, sampling
+   probabilistic initial effects with the given random stream. */
+State::State(const Problem& problem, Random& random)
+  : problem_(0), goal_(false) {
+  reset(problem, random);
+}
+
+
+/* Makes this state an initial state for the given problem, sampling
+   probabilistic initial effects with the given random stream. */
+void State::reset(const Problem& problem, Random& random) {
+  problem_ = &problem;
+  atoms_ = problem.init_atoms();
+  values_ = problem.init_values();
   for (EffectList::const_iterator ei = problem.init_effects().begin();
        ei != problem.init_effects().end(); ei++) {
     AtomList adds;
     AtomList deletes;
     UpdateList updates;
     (*ei)->state_change(adds, deletes, updates,
-                        problem.terms(), atoms_, values_);
+                        problem.terms(), atoms_, values_, random);
     atoms_.insert(adds.begin(), adds.end());
     for (UpdateList::const_iterator ui = updates.begin();
          ui != updates.end(); ui++) {
       (*ui)->affect(values_);
     }
   }
-  goal_ = problem.goal().holds(problem.terms(), atoms_, values_);
+  goal_ = problem.goal_holds(atoms_, values_);
   if (goal()) {
-    const Fluent& goal_achieved_fluent =
-      Fluent::make(problem.domain().goal_achieved(), TermList());
+    const Fluent& goal_achieved_fluent = problem.goal_achieved();
     values_[&goal_achieved_fluent] = 1;
     if (problem.goal_reward() != 0) {
       problem.goal_reward()->affect(values_);
@@ -53,71 +183,139 @@ State::State(const Problem& problem)
 }
 
 
-/* Returns a sampled successor of this state. */
-const State& State::next(const Action& action) const {
-  State* next_state = new State(*this);
+/* Stores a successor of this state, sampled with the given random
+   stream, in the given state. */
+void State::next(const Action& action, State& successor,
+                 Random& random) const {
+  if (&successor != this) {
+    successor = *this;
+  }
+  successor.transition(action, 0, 0, random);
+}
+
+
+/* Stores a successor of this state, sampled with the given random
+   stream, in the given state, and fills the provided lists with the
+   atoms and fluents that differ between this state and the
+   successor. */
+void State::next(const Action& action, State& successor,
+                 AtomList& changed_atoms, FluentList& changed_fluents,
+                 Random& random) const {
+  if (&successor != this) {
+    successor = *this;
+  }
+  successor.transition(action, &changed_atoms, &changed_fluents, random);
+}
+
+
+/* Replaces this state with a successor sampled with the given random
+   stream, and fills the provided lists, unless they are null, with the
+   atoms and fluents that differ between this state and the
+   successor.  Assigning to a state reuses the storage it already has,
+   so a transition allocates nothing once the state has grown to the
+   size of the problem. */
+void State::transition(const Action& action, AtomList* changed_atoms,
+                       FluentList* changed_fluents, Random& random) {
   if (verbosity > 1) {
     std::cerr << "selected action: " << action << std::endl;
   }
-  action.affect(problem().terms(), next_state->atoms_, next_state->values_);
-  next_state->goal_ = problem().goal().holds(problem().terms(),
-                                             next_state->atoms_,
-                                             next_state->values_);
-  if (next_state->goal()) {
-    if (!goal()) {
-      const Fluent& goal_achieved_fluent =
-        Fluent::make(problem().domain().goal_achieved(), TermList());
-      next_state->values_[&goal_achieved_fluent] = 1;
-      if (problem().goal_reward() != 0) {
-        problem().goal_reward()->affect(next_state->values_);
+  bool was_goal = goal();
+  if (changed_atoms != 0) {
+    action.affect(problem().terms(), atoms_, values_,
+                  *changed_atoms, *changed_fluents, random);
+  } else {
+    action.affect(problem().terms(), atoms_, values_, random);
+  }
+  goal_ = problem().goal_holds(atoms_, values_);
+  if (goal() && !was_goal) {
+    const Fluent& goal_achieved_fluent = problem().goal_achieved();
+    values_[&goal_achieved_fluent] = 1;
+    if (changed_fluents != 0) {
+      changed_fluents->push_back(&goal_achieved_fluent);
+    }
+    if (problem().goal_reward() != 0) {
+      problem().goal_reward()->affect(values_);
+      if (changed_fluents != 0) {
+        changed_fluents->push_back(&problem().goal_reward()->fluent());
       }
     }
   }
-  const Fluent& total_time_fluent =
-    Fluent::make(problem().domain().total_time(), TermList());
-  next_state->values_[&total_time_fluent] =
-    next_state->values_[&total_time_fluent] + 1;
+  const Fluent& total_time_fluent = problem().total_time();
+  values_[&total_time_fluent] = values_[&total_time_fluent] + 1;
+  if (changed_fluents != 0) {
+    changed_fluents->push_back(&total_time_fluent);
+  }
   if (verbosity > 1) {
     std::cerr << std::endl;
   }
-  return *next_state;
 }
 
 
 /* Prints this object on the given stream. */
 void State::printXML(std::ostream& os) const {
-  os << "<state>";
+  std::string xml;
+  printXML(xml);
+  os << xml;
+}
+
+
+/* Appends this object in XML to the given string. */
+void State::printXML(std::string& xml) const {
+  xml += "<state>";
   if (goal()) {
-    os << "<is-goal/>";
+    xml += "<is-goal/>";
   }
   for (AtomSet::const_iterator ai = atoms().begin();
        ai != atoms().end(); ai++) {
-    const Atom& atom = **ai;
-    if (!PredicateTable::static_predicate(atom.predicate())) {
-      os << "<atom><predicate>" << atom.predicate() << "</predicate>";
-      for (TermList::const_iterator ti = atom.terms().begin();
-           ti != atom.terms().end(); ti++) {
-        os << "<term>" << *ti << "</term>";
-      }
-      os << "</atom>";
-    }
+    problem().append_xml(xml, **ai);
   }
   for (ValueMap::const_iterator vi = values().begin();
        vi != values().end(); vi++) {
-    const Fluent& fluent = *vi->first;
-    if (fluent.function() != problem().domain().total_time()
-        && fluent.function() != problem().domain().goal_achieved()
-        && !FunctionTable::static_function(fluent.function())) {
-      os << "<fluent><function>" << fluent.function() << "</function>";
-      for (TermList::const_iterator ti = fluent.terms().begin();
-           ti != fluent.terms().end(); ti++) {
-        os << "<term>" << *ti << "</term>";
-      }
-      os << "<value>" << vi->second << "</value>";
-      os << "</fluent>";
+    problem().append_xml(xml, *vi->first, vi->second);
+  }
+  xml += "</state>";
+}
+
+
+/* Appends the XML for the difference between a predecessor and this
+   state to the given string, given the atoms and fluents that changed
+   in the transition. */
+void State::printXMLDelta(std::string& xml, const AtomList& changed_atoms,
+                          const FluentList& changed_fluents) const {
+  xml += "<state-delta>";
+  if (goal()) {
+    xml += "<is-goal/>";
+  }
+  std::string deleted;
+  size_t start = xml.size();
+  xml += "<add>";
+  size_t size = xml.size();
+  for (AtomList::const_iterator ai = changed_atoms.begin();
+       ai != changed_atoms.end(); ai++) {
+    if (atoms().find(*ai) != atoms().end()) {
+      problem().append_xml(xml, **ai);
+    } else {
+      problem().append_xml(deleted, **ai);
+    }
+  }
+  if (xml.size() > size) {
+    xml += "</add>";
+  } else {
+    xml.resize(start);
+  }
+  if (!deleted.empty()) {
+    xml += "<delete>";
+    xml += deleted;
+    xml += "</delete>";
+  }
+  for (FluentList::const_iterator fi = changed_fluents.begin();
+       fi != changed_fluents.end(); fi++) {
+    ValueMap::const_iterator vi = values().find(*fi);
+    if (vi != values().end()) {
+      problem().append_xml(xml, *vi->first, vi->second);
     }
   }
-  os << "</state>";
+  xml += "</state-delta>";
 }
 
 
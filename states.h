@@ -25,18 +25,173 @@
 #include "actions.h"
 #include "formulas.h"
 #include "expressions.h"
+#include "interntable.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+/* ====================================================================== */
+/* StateKey */
+
+/*
+ * A canonical, packed form of a state: the words of the atom bitset up
+ * to the last non-zero word, followed by the index and value of every
+ * fluent with a value, in index order.  Two keys are equal exactly
+ * when their states have the same atoms and fluent values, so keys can
+ * be hashed and compared word by word instead of walking the states.
+ */
+struct StateKey {
+  /* Constructs the key of the empty state. */
+  StateKey() : hash_(0) { words_.push_back(0); }
+
+  /* Constructs the key of the state with the given atoms and fluent
+     values. */
+  StateKey(const AtomSet& atoms, const ValueMap& values) {
+    assign(atoms, values);
+  }
+
+  /* Makes this the key of the state with the given atoms and fluent
+     values, reusing the storage of this key. */
+  void assign(const AtomSet& atoms, const ValueMap& values);
+
+  /* Returns the hash value of this key. */
+  size_t hash() const { return hash_; }
+
+  /* Returns the words of this key. */
+  const std::vector<uint64_t>& words() const { return words_; }
+
+ private:
+  /* Words of this key. */
+  std::vector<uint64_t> words_;
+  /* Hash value of the words. */
+  size_t hash_;
+};
+
+/* Equality operator for state keys. */
+inline bool operator==(const StateKey& k1, const StateKey& k2) {
+  return k1.hash() == k2.hash() && k1.words() == k2.words();
+}
+
+/* Inequality operator for state keys. */
+inline bool operator!=(const StateKey& k1, const StateKey& k2) {
+  return !(k1 == k2);
+}
+
+
+/* ====================================================================== */
+/* StateTable */
+
+/*
+ * A table that interns state keys to dense 32-bit identifiers, the
+ * first key getting 0.  The table is split into shards by hash value,
+ * each an open-addressing table guarded by its own lock, so threads
+ * interning states mostly work on different shards.  The key of an
+ * identifier is found without locking, through segments of doubling
+ * size that are never moved once allocated.
+ */
+struct StateTable {
+  /* Identifier that no state gets. */
+  static const uint32_t NO_ID = UINT32_MAX;
+
+  /* Constructs an empty table with at least the given number of
+     shards. */
+  explicit StateTable(size_t num_shards = 64);
+
+  /* Deletes this table. */
+  ~StateTable();
+
+  /* Returns the number of states in this table. */
+  size_t size() const { return next_id_.load(); }
+
+  /* Returns the identifier of the given key, or NO_ID if the key is
+     not in this table. */
+  uint32_t find(const StateKey& key) const;
+
+  /* Returns the identifier of the given key, adding the key to this
+     table if needed, and whether the key was added. */
+  std::pair<uint32_t, bool> intern(const StateKey& key);
+
+  /* Returns the key with the given identifier, which must have been
+     returned by this table. */
+  const StateKey& key(uint32_t id) const {
+    uint64_t n = uint64_t(id) + 1;
+    int s = 63 - __builtin_clzll(n);
+    return *segments_[s].load(std::memory_order_acquire)[n - (1ULL << s)];
+  }
+
+ private:
+  /* An interned key. */
+  struct Entry {
+    /* The key. */
+    StateKey key;
+    /* Identifier of the key. */
+    uint32_t id;
+
+    Entry(const StateKey& key, uint32_t id) : key(key), id(id) {}
+  };
+
+  /* A shard of the table. */
+  struct Shard {
+    /* Lock for the shard. */
+    mutable std::mutex mutex;
+    /* Hash table of the entries of the shard. */
+    InternTable<Entry> table;
+    /* Entries of the shard; a deque keeps them in place as it grows. */
+    std::deque<Entry> entries;
+  };
+
+  /* Number of segments; segment s holds the keys with identifiers
+     from 2^s - 1 up to 2^(s+1) - 2. */
+  static const int NUM_SEGMENTS = 32;
+
+  /* Shards of this table; the number of shards is a power of two. */
+  std::unique_ptr<Shard[]> shards_;
+  /* Number of shards minus one. */
+  size_t shard_mask_;
+  /* Keys by identifier, in segments allocated when first needed. */
+  std::atomic<const StateKey**> segments_[NUM_SEGMENTS];
+  /* Identifier for the next added key. */
+  std::atomic<uint64_t> next_id_;
+
+  /* Returns the shard for keys with the given hash value. */
+  Shard& shard(size_t hash) const {
+    /* The shard tables pick slots with the low bits. */
+    return shards_[(uint64_t(hash) >> 40) & shard_mask_];
+  }
+
+  /* Records the given key as the key with the given identifier. */
+  void publish(uint32_t id, const StateKey& key);
+};
 
 
 /* ====================================================================== */
 /* State */
 
 /*
- * A state.
+ * A state.  States are values: a successor is sampled into an existing
+ * state, or into this state itself, so that stepping through a run
+ * reuses the storage of the states involved instead of allocating a
+ * new state for each transition.
  */
 struct State {
-  /* Constructs an initial state for the given problem. */
-  explicit State(const Problem& problem);
+  /* Constructs an empty state, not associated with any problem, to be
+     filled in by reset() or next(). */
+  State() : problem_(0), goal_(false) {}
+
+  /* Constructs an initial state for the given problem, sampling
+     probabilistic initial effects with the given random stream. */
+  State(const Problem& problem, Random& random);
+
+  /* Makes this state an initial state for the given problem, sampling
+     probabilistic initial effects with the given random stream. */
+  void reset(const Problem& problem, Random& random);
 
   /* Returns the problem associated with this state. */
   const Problem& problem() const { return *problem_; }
@@ -50,12 +205,43 @@ struct State {
   /* Tests if this is a goal state. */
   bool goal() const { return goal_; }
 
-  /* Returns a sampled successor of this state. */
-  const State& next(const Action& action) const;
+  /* Stores a successor of this state, sampled with the given random
+     stream, in the given state. */
+  void next(const Action& action, State& successor, Random& random) const;
+
+  /* Stores a successor of this state, sampled with the given random
+     stream, in the given state, and fills the provided lists with the
+     atoms and fluents that differ between this state and the
+     successor. */
+  void next(const Action& action, State& successor, AtomList& changed_atoms,
+            FluentList& changed_fluents, Random& random) const;
+
+  /* Replaces this state with a successor sampled with the given random
+     stream. */
+  void advance(const Action& action, Random& random) {
+    transition(action, 0, 0, random);
+  }
+
+  /* Replaces this state with a successor sampled with the given random
+     stream, and fills the provided lists with the atoms and fluents
+     that differ between this state and the successor. */
+  void advance(const Action& action, AtomList& changed_atoms,
+               FluentList& changed_fluents, Random& random) {
+    transition(action, &changed_atoms, &changed_fluents, random);
+  }
 
   /* Prints this object on the given stream in XML. */
   void printXML(std::ostream& os) const;
 
+  /* Appends this object in XML to the given string. */
+  void printXML(std::string& xml) const;
+
+  /* Appends the XML for the difference between a predecessor and
+     this state to the given string, given the atoms and fluents that
+     changed in the transition. */
+  void printXMLDelta(std::string& xml, const AtomList& changed_atoms,
+                     const FluentList& changed_fluents) const;
+
  private:
   /* The problem that this state is associated with. */
   const Problem* problem_;
@@ -65,6 +251,13 @@ struct State {
   ValueMap values_;
   /* Whether this is a goal state. */
   bool goal_;
+
+  /* Replaces this state with a successor sampled with the given random
+     stream, and fills the provided lists, unless they are null, with
+     the atoms and fluents that differ between this state and the
+     successor. */
+  void transition(const Action& action, AtomList* changed_atoms,
+                  FluentList* changed_fluents, Random& random);
 };
 
 /* Output operator for states. */
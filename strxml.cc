@@ -16,70 +16,67 @@
  */
 #include <config.h>
 #include "strxml.h"
-#include <sstream>
-#include <stack>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <unistd.h>
 
 
-struct PSink {
-  int error;
-  const XMLNode* top;
-
-  PSink() : error(0), top(0) {}
-
-  void pushNode(const std::string& name, const str_pair_vec& params);
-  void popNode(const std::string& name);
-  void pushText(const std::string& text);
-
-  void formaterror() { error=1; }
-  void streamerror() { error=2; }
-
- private:
-  std::stack<XMLParent*> s;
-};
-
-
-static const std::string EMPTY_STRING;
+/* ====================================================================== */
+/* XMLParser */
 
+/*
+ * A parser of a single XML node from a buffer into an arena.
+ */
+struct XMLParser {
+  /* Result of parsing. */
+  enum Result { COMPLETE, INCOMPLETE, MALFORMED };
 
-static std::string next_token(int fd) {
-  static char last_char = 0;
+  /* Constructs a parser for the given buffer and arena. */
+  XMLParser(const char* buffer, size_t size, XMLArena& arena)
+    : pos(buffer), last(buffer + size), arena(arena), root(0) {}
 
-  std::string res;
-  if (last_char) {
-    res += last_char;
-  }
+  /* Parses a node. */
+  Result parse();
 
-  if (last_char == '<') {
-    last_char = 0;
-    return res;
-  }
+  /* Returns the node parsed. */
+  const XMLNode* node() const { return &arena.nodes_[root]; }
 
-  if (last_char == '>') {
-    last_char = 0;
-    return res;
-  }
+  /* Current position in the buffer. */
+  const char* pos;
+  /* Position beyond the last character in the buffer. */
+  const char* last;
+  /* Arena to parse into. */
+  XMLArena& arena;
+  /* Position of the root node in the arena. */
+  size_t root;
 
-  char next_char;
-  while (1) {
-    if (read(fd, &next_char, 1) != 1) {
-      return EMPTY_STRING;
-    }
-    if (next_char == '>' || next_char == '<') {
-      if (res.empty()) {
-        res += next_char;
-        last_char = 0;
-        return res;
-      }
-      last_char = next_char;
-      break;
-    }
-    res += next_char;
-  }
-  return res;
-}
+ private:
+  /* Parses the tag with the given content, ending at the given
+     position.  Returns the change in depth (1 for a start tag, -1 for
+     an end tag, and 0 for an empty-element tag), or -2 if the tag is
+     malformed. */
+  int parse_tag(std::string_view tag, const char* tag_end);
+
+  /* Adds an element with the parameters at the end of the arena,
+     with content starting at the given position.  Until the element
+     is closed, its text only records where its content starts and its
+     first child is a position in open_children_. */
+  void push_element(std::string_view name, size_t first_param,
+                    const char* content);
+
+  /* Closes the innermost open element, whose content ends at the given
+     position. */
+  void pop_element(const char* content_end);
+
+  /* Adds a text node to the innermost open element. */
+  void push_text(std::string_view text);
+};
 
 
+/* Returns the character class of the given character inside a tag:
+   0 for space, 2 for '=', 3 for '"', 4 for '/', and 1 for anything
+   else.  Runs of characters of the same class form a token. */
 static int token_type(char c) {
   if (c == '=')
     return 2;
@@ -87,149 +84,196 @@ static int token_type(char c) {
     return 3;
   if (c == '/')
     return 4;
-  if (isspace(c))
+  if (isspace(static_cast<unsigned char>(c)))
     return 0;
   return 1;
 }
 
 
-static str_vec tokenize_string(const std::string& str) {
-  str_vec v;
-  std::string last;
-  int t_type = 0;
-  for (const char *s = str.c_str(); *s; s++) {
-    int n_type = token_type(*s);
-
-    if (t_type != n_type && !last.empty()) {
-      if (t_type) {
-        v.push_back(last);
-      }
-      last.erase();
-    }
-    last += *s;
-    t_type = n_type;
+/* Returns the next token of a tag, advancing the given position past
+   it.  Returns an empty token at the end of the tag. */
+static std::string_view next_tag_token(const char*& pos, const char* last) {
+  while (pos != last && token_type(*pos) == 0) {
+    pos++;
   }
-  if (last.length()) {
-    v.push_back(last);
+  const char* first = pos;
+  if (pos != last) {
+    int type = token_type(*pos);
+    while (pos != last && token_type(*pos) == type) {
+      pos++;
+    }
   }
-  return v;
+  return std::string_view(first, pos - first);
 }
 
 
-static int do_node(const std::string& token, PSink& ps) {
-  str_vec node_tokens = tokenize_string(token);
+/* Parses a node. */
+XMLParser::Result XMLParser::parse() {
+  int depth = 0;
+  while (pos != last) {
+    if (*pos == '<') {
+      const char* tag = pos + 1;
+      const char* tag_end = tag;
+      while (tag_end != last && *tag_end != '<' && *tag_end != '>') {
+        tag_end++;
+      }
+      if (tag_end == last) {
+        return INCOMPLETE;
+      } else if (*tag_end == '<' || tag_end == tag) {
+        return MALFORMED;
+      }
+      int delta = parse_tag(std::string_view(tag, tag_end - tag), tag_end);
+      if (delta == -2 || depth + delta < 0) {
+        return MALFORMED;
+      }
+      depth += delta;
+      pos = tag_end + 1;
+      if (depth == 0) {
+        return COMPLETE;
+      }
+    } else {
+      const char* text = pos;
+      while (pos != last && *pos != '<') {
+        pos++;
+      }
+      if (pos == last) {
+        return INCOMPLETE;
+      }
+      push_text(std::string_view(text, pos - text));
+    }
+  }
+  return INCOMPLETE;
+}
 
-  //cout << token << ":" << endl;
-  //for (int i=0; i<node_tokens.size(); i++)
-  //  cout << node_tokens[i] << endl;
 
-  if (node_tokens.empty()) {
-    //cerr << "e1a" << endl;
+/* Parses the tag with the given content, ending at the given
+   position. */
+int XMLParser::parse_tag(std::string_view tag, const char* tag_end) {
+  const char* p = tag.data();
+  const char* q = p + tag.size();
+  std::string_view name = next_tag_token(p, q);
+  if (name.empty()) {
     return -2;
   }
-
-  if (node_tokens[0] == "/") {
-    ps.popNode(node_tokens[1]);
+  if (name == "/") {
+    if (arena.open_.empty()) {
+      return -2;
+    }
+    pop_element(tag.data() - 1);
     return -1;
   }
-  std::string name = node_tokens[0];
-  str_pair_vec v;
-  for (size_t i=1; i<node_tokens.size(); i+=5) {
-    if (node_tokens[i] == "/") {
-      ps.pushNode(name, v);
-      ps.popNode(name);
+  size_t first_param = arena.params_.size();
+  while (true) {
+    std::string_view token = next_tag_token(p, q);
+    if (token.empty()) {
+      push_element(name, first_param, tag_end + 1);
+      return 1;
+    } else if (token == "/") {
+      push_element(name, first_param, tag_end);
+      pop_element(tag_end);
       return 0;
     }
-    if (i+5 > node_tokens.size() ||
-        node_tokens[i+1] != "=" ||
-        node_tokens[i+2] != "\"" ||
-        node_tokens[i+4] != "\"") {
-      //cerr << "e1b" << endl;
+    std::string_view eq = next_tag_token(p, q);
+    std::string_view open_quote = next_tag_token(p, q);
+    std::string_view value = next_tag_token(p, q);
+    std::string_view close_quote = next_tag_token(p, q);
+    if (eq != "=" || open_quote != "\"" || close_quote != "\""
+        || value.empty()) {
+      arena.params_.resize(first_param);
       return -2;
     }
-    str_pair p(node_tokens[i], node_tokens[i+3]);
-    v.push_back(p);
+    arena.params_.push_back(str_pair(token, value));
   }
-  ps.pushNode(name, v);
-  return 1;
 }
 
 
-static bool parse_node(int fd, PSink& ps) {
-  std::string token = next_token(fd);
-  int depth = 0;
-  while (!token.empty()) {
-    if (token == "<") {
-      int delta = do_node(next_token(fd), ps);
-      if (delta == -2) {
-        //cerr << "e1" << endl;
-        ps.formaterror();
-        return false;
-      }
-      depth += delta;
-      token = next_token(fd);
-      if (token != ">") {
-        //cerr << "e2" << endl;
-        ps.formaterror();
-        return false;
-      }
-      if (depth == 0) {
-        return true;
-      }
-    } else {
-      ps.pushText(token);
-    }
-    token = next_token(fd);
+/* Adds an element with the parameters at the end of the arena, with
+   content starting at the given position. */
+void XMLParser::push_element(std::string_view name, size_t first_param,
+                             const char* content) {
+  size_t node = arena.nodes_.size();
+  arena.nodes_.push_back(XMLNode(arena, name, first_param,
+                                 arena.params_.size() - first_param));
+  if (arena.open_.empty()) {
+    root = node;
+  } else {
+    arena.open_children_.push_back(node);
   }
-  ps.streamerror();
-  return false;
+  arena.nodes_.back().text_ = std::string_view(content, 0);
+  arena.nodes_.back().first_child_ = arena.open_children_.size();
+  arena.open_.push_back(node);
 }
 
 
-void PSink::pushNode(const std::string& name, const str_pair_vec& params) {
-  //std::cout << "push: " << name << std::endl;
-  XMLParent *p = new XMLParent(name);
-  for (size_t i=0; i<params.size(); i++) {
-    p->params[params[i].first] = params[i].second;
-  }
-  if (s.empty()) {
-      if (top != NULL) delete top;
-    top = p;
-  } else {
-    s.top()->children.push_back(p);
+/* Closes the innermost open element, whose content ends at the given
+   position. */
+void XMLParser::pop_element(const char* content_end) {
+  XMLNode& node = arena.nodes_[arena.open_.back()];
+  const char* content = node.text_.data();
+  node.text_ = std::string_view(content, content_end - content);
+  size_t first_child = node.first_child_;
+  node.first_child_ = arena.children_.size();
+  node.child_count_ = arena.open_children_.size() - first_child;
+  arena.children_.insert(arena.children_.end(),
+                         arena.open_children_.begin() + first_child,
+                         arena.open_children_.end());
+  arena.open_children_.resize(first_child);
+  arena.open_.pop_back();
+}
+
+
+/* Adds a text node to the innermost open element. */
+void XMLParser::push_text(std::string_view text) {
+  if (!arena.open_.empty()) {
+    size_t node = arena.nodes_.size();
+    arena.nodes_.push_back(XMLNode(arena, std::string_view(), 0, 0));
+    arena.nodes_.back().text_ = text;
+    arena.open_children_.push_back(node);
   }
-  s.push(p);
 }
 
 
-void PSink::popNode(const std::string& name) {
-  //std::cout << "pop: " << name << std::endl;
-  s.pop();
+/* ====================================================================== */
+/* XMLNode */
+
+/* Returns the ith child of this XML node. */
+const XMLNode* XMLNode::getChild(int i) const {
+  return &arena_->nodes_[arena_->children_[first_child_ + i]];
 }
 
 
-void PSink::pushText(const std::string& text) {
-  //std::cout << "pushText: " << text << std::endl;
-  XMLText *t = new XMLText(text);
-  if (s.size() == 0) {
-    top = t;
-  } else {
-    s.top()->children.push_back(t);
+/* Returns the child of this XML node with the given name. */
+const XMLNode* XMLNode::getChild(std::string_view name) const {
+  for (size_t i = 0; i < child_count_; i++) {
+    const XMLNode* c = &arena_->nodes_[arena_->children_[first_child_ + i]];
+    if (!c->isText() && c->name_ == name) {
+      return c;
+    }
   }
+  return 0;
 }
 
 
-/* ====================================================================== */
-/* XMLNode */
+/* Returns the parameter of this XML node with the given name. */
+std::string_view XMLNode::getParam(std::string_view name) const {
+  for (size_t i = 0; i < param_count_; i++) {
+    const str_pair& param = arena_->params_[first_param_ + i];
+    if (param.first == name) {
+      return param.second;
+    }
+  }
+  return std::string_view();
+}
+
 
 /* Puts the text for the child node with the given in the
    destination string.  Returns false if no child node with the
    given name exists. */
-bool XMLNode::dissect(const std::string& child,
+bool XMLNode::dissect(std::string_view child,
                       std::string& destination) const {
   const XMLNode* c = getChild(child);
   if (c != 0) {
-    destination = c->getText();
+    destination.assign(c->getText());
     return true;
   } else {
     return false;
@@ -237,6 +281,25 @@ bool XMLNode::dissect(const std::string& child,
 }
 
 
+/* Prints this object on the given stream. */
+void XMLNode::print(std::ostream& os) const {
+  if (isText()) {
+    os << text_;
+    return;
+  }
+  os << "<" << name_;
+  for (size_t i = 0; i < param_count_; i++) {
+    const str_pair& param = arena_->params_[first_param_ + i];
+    os << " " << param.first << "=\"" << param.second << "\"";
+  }
+  os << ">";
+  for (size_t i = 0; i < child_count_; i++) {
+    os << getChild(i);
+  }
+  os << "</" << name_ << ">";
+}
+
+
 /* Output operator for XML nodes. */
 std::ostream& operator<<(std::ostream& os, const XMLNode& xn) {
   xn.print(os);
@@ -253,116 +316,254 @@ std::ostream& operator<<(std::ostream& os, const XMLNode* xn) {
 }
 
 
-/* Reads an XML node from the given file descriptor. */
-const XMLNode* read_node(int fd) {
-  PSink ps;
-  if (parse_node(fd, ps)) {
-    return ps.top;
+/* ====================================================================== */
+/* XMLArena */
+
+/* Removes all nodes from this arena. */
+void XMLArena::reset() {
+  nodes_.clear();
+  children_.clear();
+  params_.clear();
+  open_.clear();
+  open_children_.clear();
+}
+
+
+/* Reads an XML node from the beginning of the given buffer into the
+   given arena.  Returns the number of characters used, or 0 if the
+   buffer does not hold a complete node. */
+size_t read_node(const char* buffer, size_t size, XMLArena& arena,
+                 const XMLNode*& node) {
+  arena.reset();
+  XMLParser parser(buffer, size, arena);
+  XMLParser::Result result = parser.parse();
+  if (result == XMLParser::COMPLETE) {
+    node = parser.node();
   } else {
-    return 0;
+    node = 0;
   }
+  return (result == XMLParser::INCOMPLETE) ? 0 : parser.pos - buffer;
+}
+
+
+/* Reads an XML node from the given reader, blocking until a complete
+   node has been read. */
+const XMLNode* read_node(XMLReader& reader) {
+  const XMLNode* node;
+  while (!reader.next_node(node)) {
+    if (reader.fill() <= 0) {
+      return 0;
+    }
+  }
+  return node;
 }
 
 
 /* ====================================================================== */
-/* XMLText */
+/* Frames */
+
+/* Starts a frame of the given type at the end of the given string. */
+size_t begin_frame(std::string& out, FrameType type) {
+  size_t frame = out.size();
+  append_u32(out, 0);
+  append_u8(out, type);
+  return frame;
+}
 
-/* Returns the text for this XML node. */
-std::string XMLText::getText() const {
-  return text;
+
+/* Ends the frame at the given position of the given string. */
+void end_frame(std::string& out, size_t frame) {
+  set_u32(out, frame, out.size() - frame - 4);
 }
 
 
-/* Returns the name for this XML node. */
-const std::string& XMLText::getName() const {
-  return text;
+/* Appends an 8-bit integer to the given string. */
+void append_u8(std::string& out, uint8_t n) {
+  out += char(n);
 }
 
 
-/* Returns the parameter of this XML node with the given name. */
-const std::string& XMLText::getParam(std::string name) const {
-  return EMPTY_STRING;
+/* Appends a 32-bit integer to the given string. */
+void append_u32(std::string& out, uint32_t n) {
+  out.append(4, '\0');
+  set_u32(out, out.size() - 4, n);
 }
 
 
-/* Prints this object on the given stream. */
-void XMLText::print(std::ostream& os) const {
-  os << text;
+/* Replaces the 32-bit integer at the given position of the given
+   string. */
+void set_u32(std::string& out, size_t pos, uint32_t n) {
+  for (int i = 3; i >= 0; i--) {
+    out[pos + i] = char(n & 0xff);
+    n >>= 8;
+  }
 }
 
 
-/* ====================================================================== */
-/* XMLParent */
+/* Appends a 64-bit integer to the given string. */
+void append_i64(std::string& out, int64_t n) {
+  append_u32(out, uint64_t(n) >> 32);
+  append_u32(out, uint64_t(n) & 0xffffffff);
+}
 
-/* Deletes this XML parent node. */
-XMLParent::~XMLParent() {
-  for (node_vec::const_iterator ni = children.begin();
-       ni != children.end(); ni++) {
-    delete *ni;
+
+/* Appends a length-prefixed string to the given string. */
+void append_string(std::string& out, std::string_view s) {
+  append_u32(out, s.size());
+  out.append(s);
+}
+
+
+/* Decodes an 8-bit integer. */
+bool FrameDecoder::u8(uint8_t& n) {
+  if (data_.empty()) {
+    return false;
   }
+  n = data_[0];
+  data_.remove_prefix(1);
+  return true;
 }
 
 
-/* Returns the ith child of this XML node. */
-const XMLNode* XMLParent::getChild(int i) const {
-  return children[i];
+/* Decodes a 32-bit integer. */
+bool FrameDecoder::u32(uint32_t& n) {
+  if (data_.size() < 4) {
+    return false;
+  }
+  n = 0;
+  for (int i = 0; i < 4; i++) {
+    n = (n << 8) | uint8_t(data_[i]);
+  }
+  data_.remove_prefix(4);
+  return true;
 }
 
 
-/* Returns the child of this XML node with the given name. */
-const XMLNode* XMLParent::getChild(const std::string& name) const {
-  for (node_vec::const_iterator ni = children.begin();
-       ni != children.end(); ni++)  {
-    const XMLParent* p = dynamic_cast<const XMLParent*>(*ni);
-    if (p != 0 && p->name == name) {
-      return p;
+/* Decodes a 64-bit integer. */
+bool FrameDecoder::i64(int64_t& n) {
+  uint32_t high, low;
+  if (!u32(high) || !u32(low)) {
+    return false;
+  }
+  n = int64_t((uint64_t(high) << 32) | low);
+  return true;
+}
+
+
+/* Decodes a length-prefixed string. */
+bool FrameDecoder::string(std::string_view& s) {
+  uint32_t size;
+  if (!u32(size) || data_.size() < size) {
+    return false;
+  }
+  s = data_.substr(0, size);
+  data_.remove_prefix(size);
+  return true;
+}
+
+
+/* Reads a frame from the given reader, blocking until a complete frame
+   has been read. */
+bool read_frame(XMLReader& reader, int& type, std::string_view& data) {
+  while (!reader.next_frame(type, data)) {
+    if (reader.fill() <= 0) {
+      return false;
     }
   }
-  return 0;
+  return true;
 }
 
 
-/* Returns the size of this XML node. */
-int XMLParent::size() const {
-  return children.size();
+/* ====================================================================== */
+/* XMLReader */
+
+/* Size of a block of input. */
+static const size_t BLOCK_SIZE = 4096;
+
+
+/* Reads all input that is available without blocking. */
+bool XMLReader::receive() {
+  while (!eof_) {
+    if (fill() < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+  }
+  return true;
 }
 
 
-/* Returns the text for this XML node. */
-std::string XMLParent::getText() const {
-  std::ostringstream os;
-  for (node_vec::const_iterator ni = children.begin();
-       ni != children.end(); ni++) {
-    os << *ni;
+/* Removes the next node from the receive buffer. */
+bool XMLReader::next_node(const XMLNode*& node) {
+  if (first_ == last_) {
+    return false;
+  }
+  size_t used = read_node(&buffer_[first_], last_ - first_, arena_, node);
+  if (used == 0) {
+    return false;
   }
-  return os.str();
+  first_ += used;
+  if (first_ == last_) {
+    first_ = last_ = 0;
+  }
+  return true;
 }
 
 
-/* Returns the name for this XML node. */
-const std::string& XMLParent::getName() const {
-  return name;
+/* Removes the next frame from the receive buffer. */
+bool XMLReader::next_frame(int& type, std::string_view& data) {
+  FrameDecoder decoder(std::string_view(buffer_.data() + first_,
+                                        last_ - first_));
+  uint32_t size;
+  if (!decoder.u32(size) || last_ - first_ - 4 < size) {
+    return false;
+  }
+  /* An empty frame has type 0, which is not a valid type. */
+  uint8_t frame_type = 0;
+  decoder.u8(frame_type);
+  type = frame_type;
+  data = std::string_view(buffer_.data() + first_ + 4, size);
+  if (size > 0) {
+    data.remove_prefix(1);
+  }
+  first_ += 4 + size;
+  if (first_ == last_) {
+    first_ = last_ = 0;
+  }
+  return true;
 }
 
 
-/* Returns the parameter of this XML node with the given name. */
-const std::string& XMLParent::getParam(std::string name) const {
-  str_str_map::const_iterator pi = params.find(name);
-  return (pi != params.end()) ? (*pi).second : EMPTY_STRING;
+/* Parses the given frame contents as an XML node. */
+const XMLNode* XMLReader::parse(std::string_view data) {
+  const XMLNode* node;
+  if (read_node(data.data(), data.size(), arena_, node) == 0) {
+    return 0;
+  }
+  return node;
 }
 
 
-/* prints this object on the given stream. */
-void XMLParent::print(std::ostream& os) const {
-  os << "<" << name;
-  for (str_str_map::const_iterator itr = params.begin();
-       itr != params.end(); itr++) {
-    os << " " << itr->first << "=\"" << itr->second << "\"";
+/* Reads a block of input into the receive buffer. */
+ssize_t XMLReader::fill() {
+  if (buffer_.size() - last_ < BLOCK_SIZE) {
+    if (first_ > 0) {
+      memmove(&buffer_[0], &buffer_[first_], last_ - first_);
+      last_ -= first_;
+      first_ = 0;
+    }
+    if (buffer_.size() - last_ < BLOCK_SIZE) {
+      buffer_.resize(last_ + BLOCK_SIZE);
+    }
   }
-  os << ">";
-  for (node_vec::const_iterator ni = children.begin();
-       ni != children.end(); ni++) {
-    os << *ni;
+  while (true) {
+    ssize_t n = read(fd_, &buffer_[last_], buffer_.size() - last_);
+    if (n > 0) {
+      last_ += n;
+    } else if (n == 0) {
+      eof_ = true;
+    } else if (errno == EINTR) {
+      continue;
+    }
+    return n;
   }
-  os << "</" << name << ">";
 }
@@ -20,49 +20,82 @@
 #ifndef _STRXML_H
 #define _STRXML_H
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
-#include <map>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <sys/types.h>
+
+struct XMLArena;
 
 
 /* ====================================================================== */
 /* XMLNode */
 
 /*
- * An abstract XML node.
+ * An XML node.  A node is either an element with a name, parameters,
+ * and children, or a text node.  Nodes live in an arena, and names
+ * and text refer to the characters that the node was parsed from, so
+ * a node is only valid as long as both remain unchanged.
  */
 struct XMLNode {
-  /* Deletes this XML node. */
-  virtual ~XMLNode() {}
-
   /* Returns the ith child of this XML node. */
-  virtual const XMLNode* getChild(int i) const { return 0; }
+  const XMLNode* getChild(int i) const;
 
   /* Returns the child of this XML node with the given name. */
-  virtual const XMLNode* getChild(const std::string& name) const { return 0; }
+  const XMLNode* getChild(std::string_view name) const;
 
   /* Returns the size of this XML node. */
-  virtual int size() const { return 0; }
+  int size() const { return child_count_; }
 
-  /* Returns the text for this XML node. */
-  virtual std::string getText() const = 0;
+  /* Tests if this is a text node. */
+  bool isText() const { return name_.empty(); }
 
-  /* Returns the name for this XML node. */
-  virtual const std::string& getName() const = 0;
+  /* Returns the text for this XML node.  For an element, this is the
+     content between its start and end tags. */
+  std::string_view getText() const { return text_; }
+
+  /* Returns the name for this XML node, or an empty string for a text
+     node. */
+  std::string_view getName() const { return name_; }
 
   /* Returns the parameter of this XML node with the given name. */
-  virtual const std::string& getParam(std::string name) const = 0;
+  std::string_view getParam(std::string_view name) const;
 
   /* Puts the text for the child node with the given in the
      destination string.  Returns false if no child node with the
      given name exists. */
-  bool dissect(const std::string& child, std::string& destination) const;
+  bool dissect(std::string_view child, std::string& destination) const;
+
+ private:
+  /* The arena that this node belongs to. */
+  const XMLArena* arena_;
+  /* Name of this node; empty for text nodes. */
+  std::string_view name_;
+  /* Text of this node. */
+  std::string_view text_;
+  /* Position of the first child of this node in the arena. */
+  size_t first_child_;
+  /* Number of children of this node. */
+  size_t child_count_;
+  /* Position of the first parameter of this node in the arena. */
+  size_t first_param_;
+  /* Number of parameters of this node. */
+  size_t param_count_;
+
+  /* Constructs an XML node. */
+  XMLNode(const XMLArena& arena,
+          std::string_view name, size_t first_param, size_t param_count)
+    : arena_(&arena), name_(name), first_child_(0), child_count_(0),
+      first_param_(first_param), param_count_(param_count) {}
 
- protected:
   /* Prints this object on the given stream. */
-  virtual void print(std::ostream& os) const = 0;
+  void print(std::ostream& os) const;
 
+  friend struct XMLArena;
+  friend struct XMLParser;
   friend std::ostream& operator<<(std::ostream& os, const XMLNode& xn);
 };
 
@@ -72,87 +105,194 @@ std::ostream& operator<<(std::ostream& os, const XMLNode& xn);
 /* Output operator for XML node pointers. */
 std::ostream& operator<<(std::ostream& os, const XMLNode* xn);
 
-/* Reads an XML node from the given file descriptor. */
-const XMLNode* read_node(int fd);
-
 
-typedef std::pair<std::string, std::string> str_pair;
-typedef std::vector<str_pair> str_pair_vec;
+typedef std::pair<std::string_view, std::string_view> str_pair;
 typedef std::vector<std::string> str_vec;
-typedef std::map<std::string, std::string> str_str_map;
-typedef std::vector<const XMLNode*> node_vec;
 
 
 /* ====================================================================== */
-/* XMLText */
+/* XMLArena */
 
 /*
- * An XML text node.
+ * Storage for the nodes of a parsed XML document.  Storage is kept
+ * when an arena is reset, so parsing a stream of similar documents
+ * into the same arena does not allocate memory once the arena has
+ * grown to fit the largest document.
  */
-struct XMLText : public XMLNode {
-  /* The text of this node. */
-  std::string text;
-
-  /* Constructs an XML text node. */
-  XMLText(const std::string& text) : text(text) {}
+struct XMLArena {
+  /* Removes all nodes from this arena, invalidating them. */
+  void reset();
+
+ private:
+  /* Nodes. */
+  std::vector<XMLNode> nodes_;
+  /* Children of nodes, as positions in nodes_. */
+  std::vector<size_t> children_;
+  /* Parameters of nodes. */
+  std::vector<str_pair> params_;
+  /* Elements whose end tags have not been parsed, as positions in
+     nodes_. */
+  std::vector<size_t> open_;
+  /* Children of open elements. */
+  std::vector<size_t> open_children_;
+
+  friend struct XMLNode;
+  friend struct XMLParser;
+};
 
-  /* Returns the text for this XML node. */
-  virtual std::string getText() const;
+/* Reads an XML node from the beginning of the given buffer into the
+   given arena, removing any nodes already in the arena.  Returns the
+   number of characters used, or 0 if the buffer does not hold a
+   complete node.  The node read is stored in node, which is set to 0
+   if the characters used do not form a well-formed node. */
+size_t read_node(const char* buffer, size_t size, XMLArena& arena,
+                 const XMLNode*& node);
 
-  /* Returns the name for this XML node. */
-  virtual const std::string& getName() const;
 
-  /* Returns the parameter of this XML node with the given name. */
-  virtual const std::string& getParam(std::string name) const;
+/* ====================================================================== */
+/* Frames */
 
- protected:
-  /* Prints this object on the given stream. */
-  virtual void print(std::ostream& os) const;
+/*
+ * Types of binary frames.  A frame is a 32-bit length in network byte
+ * order, followed by that many bytes: a type byte and the contents of
+ * the frame.  Integers in frame contents are in network byte order,
+ * and strings are prefixed with their 32-bit length.
+ */
+enum FrameType {
+  /* An XML message. */
+  XML_FRAME = 'X',
+  /* The atoms, fluents, and actions of a problem, with their ids. */
+  DICTIONARY_FRAME = 'D',
+  /* A state. */
+  STATE_FRAME = 'S',
+  /* The changes to the previous state. */
+  STATE_DELTA_FRAME = 'T',
+  /* An action id. */
+  ACTION_FRAME = 'A',
+  /* No action. */
+  DONE_FRAME = 'N'
 };
 
+/* Starts a frame of the given type at the end of the given string.
+   Returns the position of the frame, to be passed to end_frame. */
+size_t begin_frame(std::string& out, FrameType type);
+
+/* Ends the frame at the given position of the given string. */
+void end_frame(std::string& out, size_t frame);
+
+/* Appends an 8-bit integer to the given string. */
+void append_u8(std::string& out, uint8_t n);
+
+/* Appends a 32-bit integer to the given string. */
+void append_u32(std::string& out, uint32_t n);
+
+/* Replaces the 32-bit integer at the given position of the given
+   string. */
+void set_u32(std::string& out, size_t pos, uint32_t n);
+
+/* Appends a 64-bit integer to the given string. */
+void append_i64(std::string& out, int64_t n);
+
+/* Appends a length-prefixed string to the given string. */
+void append_string(std::string& out, std::string_view s);
 
-/* ====================================================================== */
-/* XMLParent */
 
 /*
- * An XML parent node.
+ * A decoder of the contents of a frame.  Each function returns false
+ * if the contents end before the value.
  */
-struct XMLParent : public XMLNode {
-  /* Name of this node. */
-  std::string name;
-  /* Parameters of this node. */
-  str_str_map params;
-  /* Children of this node. */
-  node_vec children;
+struct FrameDecoder {
+  /* Constructs a decoder of the given frame contents. */
+  explicit FrameDecoder(std::string_view data) : data_(data) {}
 
-  /* Constructs an XML parent node. */
-  XMLParent(const std::string& name) : name(name) {}
+  /* Tests if all contents have been decoded. */
+  bool empty() const { return data_.empty(); }
 
-  /* Deletes this XML parent node. */
-  virtual ~XMLParent();
+  /* Decodes an 8-bit integer. */
+  bool u8(uint8_t& n);
 
-  /* Returns the ith child of this XML node. */
-  virtual const XMLNode* getChild(int i) const;
+  /* Decodes a 32-bit integer. */
+  bool u32(uint32_t& n);
 
-  /* Returns the child of this XML node with the given name. */
-  virtual const XMLNode* getChild(const std::string& name) const;
+  /* Decodes a 64-bit integer. */
+  bool i64(int64_t& n);
 
-  /* Returns the size of this XML node. */
-  virtual int size() const;
+  /* Decodes a length-prefixed string. */
+  bool string(std::string_view& s);
 
-  /* Returns the text for this XML node. */
-  virtual std::string getText() const;
+ private:
+  /* Contents not yet decoded. */
+  std::string_view data_;
+};
 
-  /* Returns the name for this XML node. */
-  virtual const std::string& getName() const;
 
-  /* Returns the parameter of this XML node with the given name. */
-  virtual const std::string& getParam(std::string name) const;
+/* ====================================================================== */
+/* XMLReader */
 
- protected:
-  /* prints this object on the given stream. */
-  virtual void print(std::ostream& os) const;
+/*
+ * A reader of XML nodes from a file descriptor.  Input is read in
+ * blocks into a receive buffer, and nodes are parsed into an arena;
+ * both are reused for the lifetime of the reader.  A node read is
+ * valid until the next node is read or more input is received.
+ */
+struct XMLReader {
+  /* Constructs a reader for the given file descriptor. */
+  explicit XMLReader(int fd) : fd_(fd), first_(0), last_(0), eof_(false) {}
+
+  /* Returns the file descriptor of this reader. */
+  int fd() const { return fd_; }
+
+  /* Tests if the end of input has been reached. */
+  bool eof() const { return eof_; }
+
+  /* Reads all input that is available without blocking, assuming a
+     non-blocking file descriptor.  Returns false on a read error. */
+  bool receive();
+
+  /* Removes the next node from the receive buffer.  Returns false if
+     the buffer does not hold a complete node.  Otherwise, the node is
+     stored in node, which is set to 0 if the input is malformed. */
+  bool next_node(const XMLNode*& node);
+
+  /* Removes the next frame from the receive buffer.  Returns false if
+     the buffer does not hold a complete frame.  Otherwise, the type
+     and contents of the frame are stored in type and data, and the
+     contents are valid until more input is received. */
+  bool next_frame(int& type, std::string_view& data);
+
+  /* Parses the given frame contents as an XML node.  Returns 0 if the
+     contents are not a well-formed node.  The node is valid until the
+     next node is read or more input is received. */
+  const XMLNode* parse(std::string_view data);
+
+  /* Reads a block of input into the receive buffer.  Returns the
+     number of characters read, 0 at the end of input, or -1 on
+     error. */
+  ssize_t fill();
+
+ private:
+  /* File descriptor to read from. */
+  int fd_;
+  /* Receive buffer. */
+  std::vector<char> buffer_;
+  /* Position of the first unused character in the buffer. */
+  size_t first_;
+  /* Position beyond the last character in the buffer. */
+  size_t last_;
+  /* Whether the end of input has been reached. */
+  bool eof_;
+  /* Arena for the last node read. */
+  XMLArena arena_;
 };
 
+/* Reads an XML node from the given reader, blocking until a complete
+   node has been read.  Returns 0 on error or at the end of input. */
+const XMLNode* read_node(XMLReader& reader);
+
+/* Reads a frame from the given reader, blocking until a complete
+   frame has been read.  Returns false on error or at the end of
+   input. */
+bool read_frame(XMLReader& reader, int& type, std::string_view& data);
+
 
 #endif /* _STRXML_H */
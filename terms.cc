@@ -32,6 +32,17 @@ Variable Term::as_variable() const {
 }
 
 
+/* Converts this term to an object.  Fails if the term is not an
+   object. */
+Object Term::as_object() const {
+  if (object()) {
+    return Object(index_);
+  } else {
+    throw std::bad_cast();
+  }
+}
+
+
 /* Output operator for terms. */
 std::ostream& operator<<(std::ostream& os, const Term& t) {
   if (t.object()) {
@@ -22,6 +22,7 @@
 
 #include <config.h>
 #include "types.h"
+#include <functional>
 #include <iostream>
 #include <map>
 #include <string>
@@ -88,6 +89,10 @@ struct Term {
      variable. */
   Variable as_variable() const;
 
+  /* Converts this term to an object.  Fails if the term is not an
+     object. */
+  Object as_object() const;
+
  private:
   /* Term index. */
   int index_;
@@ -96,6 +101,7 @@ struct Term {
   friend bool operator<(const Term& t1, const Term& t2);
   friend std::ostream& operator<<(std::ostream& os, const Term& t);
   friend struct TermTable;
+  friend struct std::hash<Term>;
 };
 
 /* Converts this object to a term. */
@@ -122,6 +128,17 @@ inline bool operator<(const Term& t1, const Term& t2) {
 /* Output operator for terms. */
 std::ostream& operator<<(std::ostream& os, const Term& t);
 
+/*
+ * Hash function object for terms.
+ */
+namespace std {
+template<>
+struct hash<Term> {
+  /* Hash function operator. */
+  size_t operator()(const Term& t) const { return t.index_; }
+};
+}
+
 
 /* ====================================================================== */
 /* SubstitutionMap */
@@ -200,6 +217,9 @@ struct TermTable {
      type. */
   const ObjectList& compatible_objects(const Type& type) const;
 
+  /* Returns the objects added to this table, keyed by name. */
+  const std::map<std::string, Object>& objects() const { return objects_; }
+
  private:
   /* Object names. */
   static std::vector<std::string> names_;
@@ -121,6 +121,9 @@ struct TypeTable {
      type with the given name exists in this table. */
   const Type* find_type(const std::string& name) const;
 
+  /* Returns the simple types of this table, keyed by name. */
+  const std::map<std::string, Type>& types() const { return types_; }
+
  private:
   /* Type names. */
   static std::vector<std::string> names_;